@@ -0,0 +1,726 @@
+// the lexer shared by lex, syn and net: a 256-entry character class table
+// decides what a token is, and runs of spaces, names and numbers are
+// skipped 16 or 32 bytes at a time with SSE4.2 or AVX2 when the CPU has them
+#ifndef EVL_LEXER_H
+#define EVL_LEXER_H
+
+#include <assert.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define EVL_MMAP		// evl files are mapped instead of read
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define EVL_X86_LEXER		// SSE4.2/AVX2 scanners, picked at run time
+#include <immintrin.h>
+#endif
+
+// the text of a token, pointing into the evl_source it was lexed from
+struct evl_text
+{
+	const char *begin;
+	size_t size;
+	bool operator==(const char *s) const {return (strncmp(begin, s, size) == 0) && (s[size] == '\0');}
+	operator std::string() const {return std::string(begin, size);}
+}; //Structure evl_text
+
+inline std::ostream &operator<<(std::ostream &out, const evl_text &text)
+{
+	return out.write(text.begin, text.size);
+}
+
+struct evl_token
+{
+	enum token_type{NAME,NUMBER,SINGLE};
+	token_type type;
+	evl_text str;
+	int line_no;
+}; //Structure Evl_token
+
+typedef std::vector<evl_token> evl_tokens;
+
+// the whole evl file, mapped into memory where the system allows it, so
+// tokens can refer to their text without copying it
+class evl_source
+{
+public:
+	evl_source() : data_(0), size_(0), mapped_(false) {}
+	~evl_source();
+	bool open(const std::string &file_name);
+	const char *begin() const {return data_;}
+	const char *end() const {return data_+size_;}
+private:
+	const char *data_;
+	size_t size_;
+	bool mapped_;
+	std::vector<char> buffer_;	// the contents when they are not mapped
+	evl_source(const evl_source &);
+	evl_source &operator=(const evl_source &);
+}; //class evl_source
+
+inline evl_source::~evl_source()
+{
+#ifdef EVL_MMAP
+	if (mapped_)
+		munmap((void *)data_, size_);
+#endif
+}
+
+inline bool evl_source::open(const std::string &file_name)
+{
+#ifdef EVL_MMAP
+	int fd = ::open(file_name.c_str(), O_RDONLY);
+	struct stat st;
+	if ((fd != -1) && (fstat(fd, &st) == 0) && S_ISREG(st.st_mode) && (st.st_size > 0))
+	{
+		void *p = mmap(0, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED)
+		{
+			close(fd);
+			data_ = (const char *)p;
+			size_ = size_t(st.st_size);
+			mapped_ = true;
+			return true;
+		}
+	}
+	if (fd != -1)
+		close(fd);
+#endif
+	std::ifstream input_file(file_name.c_str(), std::ios::in | std::ios::binary);
+	if (!input_file)
+	{
+		std::cerr << "Cannot read file: " << file_name << "." << std::endl;
+		return false;
+	}
+	buffer_.assign(std::istreambuf_iterator<char>(input_file), std::istreambuf_iterator<char>());
+	data_ = buffer_.empty()? 0: &buffer_[0];
+	size_ = buffer_.size();
+	return true;
+}
+
+// character classes: a NAME starts with NAME_FIRST and goes on with NAME,
+// a NUMBER is made of DIGITs, and a '/' must start a "//" comment
+enum evl_char_class
+{
+	EVL_SPACE = 1, EVL_NAME_FIRST = 2, EVL_NAME = 4, EVL_DIGIT = 8, EVL_SINGLE = 16, EVL_SLASH = 32
+};
+
+struct evl_char_table
+{
+	unsigned char class_[256];
+	evl_char_table();
+}; //Structure evl_char_table
+
+inline evl_char_table::evl_char_table()
+{
+	for (int c = 0; c < 256; ++c)
+	{
+		unsigned char k = 0;
+		if ((c == ' ') || ((c >= '\t') && (c <= '\r')))
+			k = EVL_SPACE;
+		else if (((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) || (c == '_'))
+			k = EVL_NAME_FIRST | EVL_NAME;
+		else if ((c >= '0') && (c <= '9'))
+			k = EVL_DIGIT | EVL_NAME;
+		else if (c == '$')
+			k = EVL_NAME;
+		else if (strchr("()[]:;,={}", c) && (c != 0))	// "{", "}" and "=" are SINGLEs too
+			k = EVL_SINGLE;
+		else if (c == '/')
+			k = EVL_SLASH;
+		class_[c] = k;
+	}
+}
+
+static const evl_char_table evl_chars;
+
+// each scanner returns the end of the run starting at p; skip_spaces also
+// counts the newlines it skips
+struct evl_scanner
+{
+	const char *(*skip_spaces)(const char *p, const char *end, int &line_no);
+	const char *(*skip_name)(const char *p, const char *end);
+	const char *(*skip_digits)(const char *p, const char *end);
+}; //Structure evl_scanner
+
+inline const char *evl_skip_class(const char *p, const char *end, unsigned char k)
+{
+	while ((p != end) && (evl_chars.class_[(unsigned char)*p] & k))
+		++p;
+	return p;
+}
+
+// most names and numbers are short: the scanners only take over after the
+// first 8 bytes of a run
+inline const char *evl_skip_short(const char *p, const char *end, unsigned char k)
+{
+	const char *short_end = (end-p > 8)? p+8: end;
+	while ((p != short_end) && (evl_chars.class_[(unsigned char)*p] & k))
+		++p;
+	return p;
+}
+
+inline const char *evl_scalar_skip_spaces(const char *p, const char *end, int &line_no)
+{
+	for (; (p != end) && (evl_chars.class_[(unsigned char)*p] & EVL_SPACE); ++p)
+	{
+		if (*p == '\n')
+			++line_no;
+	}
+	return p;
+}
+
+inline const char *evl_scalar_skip_name(const char *p, const char *end)
+{
+	return evl_skip_class(p, end, EVL_NAME);
+}
+
+inline const char *evl_scalar_skip_digits(const char *p, const char *end)
+{
+	return evl_skip_class(p, end, EVL_DIGIT);
+}
+
+#ifdef EVL_X86_LEXER
+// 16 bytes at a time: PCMPESTRI finds the first byte outside the ranges
+#define EVL_SSE42_SKIP(ranges, num_ranges) \
+	const __m128i r = _mm_loadu_si128((const __m128i *)ranges); \
+	for (; end-p >= 16; p += 16) \
+	{ \
+		int i = _mm_cmpestri(r, num_ranges, _mm_loadu_si128((const __m128i *)p), 16, \
+			_SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_NEGATIVE_POLARITY | _SIDD_LEAST_SIGNIFICANT); \
+		if (i != 16) \
+			return p+i; \
+	}
+
+__attribute__((target("sse4.2"))) inline const char *evl_sse42_skip_spaces(const char *p, const char *end, int &line_no)
+{
+	static const char ranges[16] = {'\t', '\r', ' ', ' '};
+	const __m128i r = _mm_loadu_si128((const __m128i *)ranges), newline = _mm_set1_epi8('\n');
+	for (; end-p >= 16; p += 16)
+	{
+		__m128i chunk = _mm_loadu_si128((const __m128i *)p);
+		int i = _mm_cmpestri(r, 4, chunk, 16,
+			_SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_NEGATIVE_POLARITY | _SIDD_LEAST_SIGNIFICANT);
+		unsigned newlines = unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline)));
+		line_no += __builtin_popcount(newlines & ((1u << i)-1));
+		if (i != 16)
+			return p+i;
+	}
+	return evl_scalar_skip_spaces(p, end, line_no);
+}
+
+__attribute__((target("sse4.2"))) inline const char *evl_sse42_skip_name(const char *p, const char *end)
+{
+	static const char ranges[16] = {'a', 'z', 'A', 'Z', '0', '9', '_', '_', '$', '$'};
+	EVL_SSE42_SKIP(ranges, 10)
+	return evl_scalar_skip_name(p, end);
+}
+
+__attribute__((target("sse4.2"))) inline const char *evl_sse42_skip_digits(const char *p, const char *end)
+{
+	static const char ranges[16] = {'0', '9'};
+	EVL_SSE42_SKIP(ranges, 2)
+	return evl_scalar_skip_digits(p, end);
+}
+
+#undef EVL_SSE42_SKIP
+
+// 32 bytes at a time: bytes are compared as signed so anything above 127
+// falls outside every range
+__attribute__((target("avx2"))) inline __m256i evl_avx2_in_range(__m256i chunk, char lo, char hi)
+{
+	return _mm256_and_si256(_mm256_cmpgt_epi8(chunk, _mm256_set1_epi8(char(lo-1))),
+		_mm256_cmpgt_epi8(_mm256_set1_epi8(char(hi+1)), chunk));
+}
+
+__attribute__((target("avx2"))) inline const char *evl_avx2_skip_spaces(const char *p, const char *end, int &line_no)
+{
+	for (; end-p >= 32; p += 32)
+	{
+		__m256i chunk = _mm256_loadu_si256((const __m256i *)p);
+		__m256i spaces = _mm256_or_si256(evl_avx2_in_range(chunk, '\t', '\r'), _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(' ')));
+		unsigned others = ~unsigned(_mm256_movemask_epi8(spaces));
+		unsigned newlines = unsigned(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('\n'))));
+		if (others != 0)
+		{
+			int i = __builtin_ctz(others);
+			line_no += __builtin_popcount(newlines & ((1u << i)-1));
+			return p+i;
+		}
+		line_no += __builtin_popcount(newlines);
+	}
+	return evl_scalar_skip_spaces(p, end, line_no);
+}
+
+__attribute__((target("avx2"))) inline const char *evl_avx2_skip_name(const char *p, const char *end)
+{
+	for (; end-p >= 32; p += 32)
+	{
+		__m256i chunk = _mm256_loadu_si256((const __m256i *)p);
+		__m256i letters = evl_avx2_in_range(_mm256_or_si256(chunk, _mm256_set1_epi8(0x20)), 'a', 'z');	// either case
+		__m256i others = _mm256_or_si256(evl_avx2_in_range(chunk, '0', '9'),
+			_mm256_or_si256(_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('_')), _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('$'))));
+		unsigned outside = ~unsigned(_mm256_movemask_epi8(_mm256_or_si256(letters, others)));
+		if (outside != 0)
+			return p+__builtin_ctz(outside);
+	}
+	return evl_scalar_skip_name(p, end);
+}
+
+__attribute__((target("avx2"))) inline const char *evl_avx2_skip_digits(const char *p, const char *end)
+{
+	for (; end-p >= 32; p += 32)
+	{
+		unsigned outside = ~unsigned(_mm256_movemask_epi8(evl_avx2_in_range(_mm256_loadu_si256((const __m256i *)p), '0', '9')));
+		if (outside != 0)
+			return p+__builtin_ctz(outside);
+	}
+	return evl_scalar_skip_digits(p, end);
+}
+#endif
+
+// isa is "auto" for the best one the CPU supports, or one of "avx2",
+// "sse42" and "scalar"
+inline bool evl_get_scanner(const std::string &isa, evl_scanner &scanner)
+{
+	std::string chosen = isa;
+#ifdef EVL_X86_LEXER
+	__builtin_cpu_init();
+	bool has_sse42 = __builtin_cpu_supports("sse4.2"), has_avx2 = __builtin_cpu_supports("avx2");
+#else
+	bool has_sse42 = false, has_avx2 = false;
+#endif
+	if (chosen == "auto")
+		chosen = has_avx2? "avx2": has_sse42? "sse42": "scalar";
+	if (((chosen == "avx2") && !has_avx2) || ((chosen == "sse42") && !has_sse42)
+		|| ((chosen != "avx2") && (chosen != "sse42") && (chosen != "scalar")))
+	{
+		std::cerr << "Lexer '" << isa << "' is not available on this machine" << std::endl;
+		return false;
+	}
+	scanner.skip_spaces = evl_scalar_skip_spaces;
+	scanner.skip_name = evl_scalar_skip_name;
+	scanner.skip_digits = evl_scalar_skip_digits;
+#ifdef EVL_X86_LEXER
+	if (chosen == "avx2")
+	{
+		scanner.skip_spaces = evl_avx2_skip_spaces;
+		scanner.skip_name = evl_avx2_skip_name;
+		scanner.skip_digits = evl_avx2_skip_digits;
+	}
+	else if (chosen == "sse42")
+	{
+		scanner.skip_spaces = evl_sse42_skip_spaces;
+		scanner.skip_name = evl_sse42_skip_name;
+		scanner.skip_digits = evl_sse42_skip_digits;
+	}
+#endif
+	return true;
+}
+
+// pulls one token at a time out of [begin, end), so a parser can consume
+// tokens as they are lexed instead of keeping them all
+class evl_lexer
+{
+public:
+	evl_lexer(const char *begin, const char *end, const evl_scanner &scanner, int line_no = 1, std::ostream &err = std::cerr)
+		: p_(begin), end_(end), scanner_(scanner), line_no_(line_no), err_(err), failed_(false) {}
+
+	// false at the end of the source or on an error
+	bool next(evl_token &token)
+	{
+		while (p_ != end_)
+		{
+			const char *p = p_;
+			unsigned char k = evl_chars.class_[(unsigned char)*p];
+			token.line_no = line_no_;
+			token.str.begin = p;
+			if (k & EVL_SPACE)
+			{
+				if (*p == '\n')
+					++line_no_;
+				if ((++p != end_) && (evl_chars.class_[(unsigned char)*p] & EVL_SPACE))
+					p = scanner_.skip_spaces(p, end_, line_no_);
+				p_ = p;
+				continue;
+			}
+			else if (k & EVL_NAME_FIRST)
+			{
+				token.type = evl_token::NAME;
+				p = evl_skip_short(p+1, end_, EVL_NAME);
+				if ((p != end_) && (evl_chars.class_[(unsigned char)*p] & EVL_NAME))
+					p = scanner_.skip_name(p, end_);
+			}
+			else if (k & EVL_DIGIT)
+			{
+				token.type = evl_token::NUMBER;
+				p = evl_skip_short(p+1, end_, EVL_DIGIT);
+				if ((p != end_) && (evl_chars.class_[(unsigned char)*p] & EVL_DIGIT))
+					p = scanner_.skip_digits(p, end_);
+			}
+			else if (k & EVL_SINGLE)
+			{
+				token.type = evl_token::SINGLE;
+				++p;
+			}
+			else if (k & EVL_SLASH)
+			{
+				++p;
+				if ((p == end_) || (*p != '/'))
+					return fail("a single / is not allowed");
+				const char *newline = (const char *)memchr(p, '\n', end_-p);	// skip the rest of the line
+				p_ = newline? newline: end_;
+				continue;
+			}
+			else
+			{
+				return fail("invalid character");
+			}
+			token.str.size = p-token.str.begin;
+			p_ = p;
+			return true;
+		}
+		return false;
+	}
+
+	bool failed() const {return failed_;}
+
+private:
+	bool fail(const char *message)
+	{
+		err_ << "LINE " << line_no_ << ": " << message << std::endl;
+		failed_ = true;
+		p_ = end_;
+		return false;
+	}
+
+	const char *p_, *end_;
+	const evl_scanner &scanner_;
+	int line_no_;
+	std::ostream &err_;
+	bool failed_;
+}; //class evl_lexer
+
+// tokens are appended as (type, text, line) records pointing into [begin,
+// end), so lexing does not allocate anything per token; on an error the
+// tokens before it are kept
+inline bool extract_tokens_from_buffer(const char *begin, const char *end, const evl_scanner &scanner, evl_tokens &tokens,
+	int line_no = 1, std::ostream &err = std::cerr)
+{
+	tokens.reserve(tokens.size()+(end-begin)/8);	// typical evl files have a token every 8 to 10 bytes
+	evl_lexer lexer(begin, end, scanner, line_no, err);
+	for (evl_token token; lexer.next(token);)
+		tokens.push_back(token);
+	return !lexer.failed();
+}
+
+// 64-bit FNV-1a of [begin, end), used to tell whether a file derived from
+// a source is still fresh
+inline uint64_t evl_hash(const char *begin, const char *end)
+{
+	uint64_t h = 14695981039346656037ull;
+	for (const char *p = begin; p != end; ++p)
+		h = (h ^ (unsigned char)*p)*1099511628211ull;
+	return h;
+}
+
+inline size_t evl_default_threads()
+{
+	return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+// runs f(0), ..., f(n-1) on up to threads threads, each taking the next
+// index as soon as it is done with the previous one
+template <class F> void evl_parallel_for(size_t n, size_t threads, F f)
+{
+	threads = std::min(threads, n);
+	if (threads <= 1)
+	{
+		for (size_t i = 0; i < n; ++i)
+			f(i);
+		return;
+	}
+	std::atomic<size_t> next(0);
+	std::vector<std::thread> pool;
+	for (size_t t = 0; t < threads; ++t)
+	{
+		pool.push_back(std::thread([&]() {
+			for (size_t i; (i = next++) < n;)
+				f(i);
+		}));
+	}
+	for (size_t t = 0; t < threads; ++t)
+		pool[t].join();
+}
+
+// a ';' outside of a comment is a token of its own and ends a statement
+inline bool evl_ends_statement(const char *begin, const char *p)
+{
+	const char *line = p;
+	while ((line != begin) && (line[-1] != '\n'))
+		--line;
+	for (; line+1 < p; ++line)
+	{
+		if ((line[0] == '/') && (line[1] == '/'))
+			return false;
+	}
+	return true;
+}
+
+// cuts [begin, end) into up to n chunks of at least min_chunk bytes, each
+// ending right after a ';' that ends a statement, so no token, comment or
+// statement spans two chunks
+inline std::vector<const char *> evl_split_source(const char *begin, const char *end, size_t n, size_t min_chunk)
+{
+	n = std::max(std::min(n, size_t(end-begin)/min_chunk), size_t(1));
+	std::vector<const char *> bounds(1, begin);
+	for (size_t i = 1; i < n; ++i)
+	{
+		const char *p = std::max(begin+(end-begin)*i/n, bounds.back());
+		while ((p = (const char *)memchr(p, ';', end-p)) && !evl_ends_statement(begin, p))
+			++p;
+		if (!p)
+			break;
+		bounds.push_back(p+1);
+	}
+	bounds.push_back(end);
+	return bounds;
+}
+
+inline int evl_count_lines(const char *begin, const char *end)
+{
+	return int(std::count(begin, end, '\n'));
+}
+
+// large sources are lexed on up to threads threads in chunks of at least
+// 256 KB; each chunk is numbered from line 1 and renumbered as it is
+// merged, and the first chunk with an error is lexed again to report it
+// with its real line number and keep the tokens before it
+inline bool extract_tokens_in_chunks(const char *begin, const char *end, const evl_scanner &scanner, size_t threads, evl_tokens &tokens)
+{
+	std::vector<const char *> bounds = evl_split_source(begin, end, threads, 256*1024);
+	size_t n = bounds.size()-1;
+	if (n == 1)
+		return extract_tokens_from_buffer(begin, end, scanner, tokens);
+	std::vector<evl_tokens> chunks(n);
+	std::vector<int> newlines(n, 0);
+	std::vector<char> ok(n, 0);
+	evl_parallel_for(n, threads, [&](size_t i) {
+		std::ostream quiet(0);
+		ok[i] = extract_tokens_from_buffer(bounds[i], bounds[i+1], scanner, chunks[i], 1, quiet);
+		newlines[i] = evl_count_lines(bounds[i], bounds[i+1]);
+	});
+	size_t total = tokens.size();
+	for (size_t i = 0; i < n; ++i)
+		total += chunks[i].size();
+	tokens.reserve(total);
+	int first_line = 1;
+	for (size_t i = 0; i < n; ++i)
+	{
+		if (!ok[i])
+			return extract_tokens_from_buffer(bounds[i], bounds[i+1], scanner, tokens, first_line);
+		for (evl_tokens::iterator it = chunks[i].begin(); it != chunks[i].end(); ++it)
+		{
+			it->line_no += first_line-1;
+			tokens.push_back(*it);
+		}
+		first_line += newlines[i];
+	}
+	return true;
+}
+
+// the tokens point into source, which must outlive them; threads is 0 for
+// one per core
+inline bool extract_tokens_from_source(const evl_source &source, evl_tokens &tokens, size_t threads = 0)
+{
+	evl_scanner scanner;
+	if (!evl_get_scanner("auto", scanner))
+	{
+		return false;
+	}
+	tokens.clear();
+	return extract_tokens_in_chunks(source.begin(), source.end(), scanner, (threads == 0)? evl_default_threads(): threads, tokens);
+}
+
+inline bool extract_tokens_from_file(std::string file_name, evl_source &source, evl_tokens &tokens, size_t threads = 0)
+{
+	return source.open(file_name) && extract_tokens_from_source(source, tokens, threads);
+}
+
+// the binary .tokens format, written by lex format=binary: a header with
+// the hash of the source, the distinct token texts, each as a varint length
+// and its bytes, then one record per token: a byte with the type in the low
+// 2 bits and the lines since the previous token in the high 6 bits, where
+// 63 means a varint with the rest follows, and the varint index of its text
+struct evl_tokens_header
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t source_hash;
+	uint64_t num_texts, num_tokens;
+}; //Structure evl_tokens_header
+
+const uint32_t evl_tokens_version = 1;
+
+inline void evl_put_varint(std::string &out, uint64_t v)
+{
+	for (; v >= 0x80; v >>= 7)
+		out.push_back(char(v | 0x80));
+	out.push_back(char(v));
+}
+
+inline bool evl_get_varint(const char *&p, const char *end, uint64_t &v)
+{
+	v = 0;
+	for (int shift = 0; (p != end) && (shift < 64); shift += 7)
+	{
+		unsigned char b = (unsigned char)*p++;
+		v |= uint64_t(b & 0x7f) << shift;
+		if (!(b & 0x80))
+			return true;
+	}
+	return false;
+}
+
+inline void store_binary_tokens(std::ostream &out, uint64_t source_hash, const evl_tokens &tokens)
+{
+	std::unordered_map<std::string, uint64_t> text_ids;
+	std::string texts, records;
+	int line_no = 1;
+	for (evl_tokens::const_iterator it = tokens.begin(); it != tokens.end(); ++it)
+	{
+		std::pair<std::unordered_map<std::string, uint64_t>::iterator, bool> id
+			= text_ids.insert(std::make_pair(std::string(it->str), uint64_t(text_ids.size())));
+		if (id.second)
+		{
+			evl_put_varint(texts, it->str.size);
+			texts.append(it->str.begin, it->str.size);
+		}
+		unsigned delta = unsigned(it->line_no-line_no);
+		line_no = it->line_no;
+		records.push_back(char(it->type | (std::min(delta, 63u) << 2)));
+		if (delta >= 63)
+			evl_put_varint(records, delta-63);
+		evl_put_varint(records, id.first->second);
+	}
+	evl_tokens_header header = {{'E', 'V', 'L', 'T'}, evl_tokens_version, source_hash, text_ids.size(), tokens.size()};
+	out.write((const char *)&header, sizeof(header));
+	out.write(texts.data(), std::streamsize(texts.size()));
+	out.write(records.data(), std::streamsize(records.size()));
+}
+
+// pulls the tokens out of a binary .tokens file like evl_lexer does out of
+// a source; the texts point into the mapped file
+class evl_token_decoder
+{
+public:
+	evl_token_decoder() : p_(0), end_(0), remaining_(0), line_no_(1), failed_(false) {}
+
+	// false, quietly, when the file is missing, not binary or was written
+	// for another source
+	bool open(const std::string &file_name, uint64_t source_hash)
+	{
+		if (!std::ifstream(file_name.c_str()))
+			return false;
+		evl_tokens_header header;
+		if (!file_.open(file_name) || (size_t(file_.end()-file_.begin()) < sizeof(header)))
+			return false;
+		memcpy(&header, file_.begin(), sizeof(header));
+		if ((memcmp(header.magic, "EVLT", 4) != 0) || (header.version != evl_tokens_version)
+			|| (header.source_hash != source_hash))
+			return false;
+		p_ = file_.begin()+sizeof(header);
+		end_ = file_.end();
+		texts_.clear();
+		for (uint64_t i = 0; i < header.num_texts; ++i)
+		{
+			evl_text text;
+			uint64_t size;
+			if (!evl_get_varint(p_, end_, size) || (size > uint64_t(end_-p_)))
+				return false;
+			text.begin = p_;
+			text.size = size_t(size);
+			texts_.push_back(text);
+			p_ += size;
+		}
+		remaining_ = header.num_tokens;
+		return true;
+	}
+
+	size_t size() const {return size_t(remaining_);}
+
+	// false after the last token or, see failed(), on a damaged record,
+	// which is not reported since the source can be lexed instead
+	bool next(evl_token &token)
+	{
+		if (remaining_ == 0)
+			return false;
+		uint64_t delta, id;
+		if ((p_ == end_) || ((*p_ & 3) > evl_token::SINGLE))
+			return fail();
+		unsigned char kind = (unsigned char)*p_++;
+		delta = kind >> 2;
+		if (delta == 63)
+		{
+			uint64_t rest;
+			if (!evl_get_varint(p_, end_, rest))
+				return fail();
+			delta += rest;
+		}
+		if (!evl_get_varint(p_, end_, id) || (id >= texts_.size()))
+			return fail();
+		line_no_ += int(delta);
+		token.type = evl_token::token_type(kind & 3);
+		token.str = texts_[size_t(id)];
+		token.line_no = line_no_;
+		--remaining_;
+		return true;
+	}
+
+	bool failed() const {return failed_;}
+
+private:
+	bool fail()
+	{
+		failed_ = true;
+		remaining_ = 0;
+		return false;
+	}
+
+	evl_source file_;
+	std::vector<evl_text> texts_;
+	const char *p_, *end_;
+	uint64_t remaining_;
+	int line_no_;
+	bool failed_;
+}; //class evl_token_decoder
+
+// reads the tokens of a fresh binary .tokens file instead of lexing the
+// source; the tokens point into decoder, which must outlive them
+inline bool load_binary_tokens(std::string file_name, uint64_t source_hash, evl_token_decoder &decoder, evl_tokens &tokens)
+{
+	if (!decoder.open(file_name, source_hash))
+		return false;
+	tokens.clear();
+	tokens.reserve(decoder.size());
+	for (evl_token token; decoder.next(token);)
+		tokens.push_back(token);
+	return !decoder.failed();
+}
+
+#endif
@@ -1,6 +1,37 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <cstdlib>
+#include <ctime>
+
+#include "evl_lexer.h"
+
+// lexes the source repeats times with each scanner the CPU supports and
+// reports the throughput
+void benchmark_lexer(const evl_source &source, int repeats)
+{
+    const char *isas[] = {"scalar", "sse42", "avx2"};
+    double megabytes = double(source.end()-source.begin())*repeats/1e6;
+    for (size_t i = 0; i < sizeof(isas)/sizeof(isas[0]); ++i)
+    {
+        evl_scanner scanner;
+        std::streambuf *err = std::cerr.rdbuf(0);    // unavailable scanners are skipped quietly
+        bool available = evl_get_scanner(isas[i], scanner);
+        std::cerr.rdbuf(err);
+        if (!available)
+            continue;
+        evl_tokens tokens;
+        std::clock_t start = std::clock();
+        for (int r = 0; r < repeats; ++r)
+        {
+            tokens.clear();
+            extract_tokens_from_buffer(source.begin(), source.end(), scanner, tokens);
+        }
+        double seconds = double(std::clock()-start)/CLOCKS_PER_SEC;
+        std::cout << isas[i] << ": " << tokens.size() << " tokens, "
+            << (seconds > 0? megabytes/seconds: 0) << " MB/s" << std::endl;
+    }
+}
 
 int main(int argc, char *argv[])
 {
@@ -10,102 +41,65 @@ int main(int argc, char *argv[])
         return -1;
     }
 
-    std::ifstream input_file(argv[1]);
-    if (!input_file)
+    evl_source source;
+    if (!source.open(argv[1]))
     {
-        std::cerr << "I can't read " << argv[1] << "." << std::endl;
         return -1;
     }
 
+    // bench=<repeats> only measures the lexer, format=binary writes the
+    // .tokens file syn and net read instead of lexing the source again
+    int repeats = 0;
+    bool binary = false;
+    for (int i = 2; i < argc; ++i)
+    {
+        std::string option = argv[i];
+        if ((option.compare(0, 6, "bench=") == 0) && ((repeats = atoi(option.c_str()+6)) > 0))
+            continue;
+        else if ((option == "format=binary") || (option == "format=text"))
+            binary = (option == "format=binary");
+        else
+        {
+            std::cerr << "Unknown option '" << option << "'" << std::endl;
+            return -1;
+        }
+    }
+    if (repeats > 0)
+    {
+        benchmark_lexer(source, repeats);
+        return 0;
+    }
+
     std::string output_file_name = std::string(argv[1])+".tokens";
-    std::ofstream output_file(output_file_name.c_str());
+    std::ofstream output_file(output_file_name.c_str(), binary? std::ios::out | std::ios::binary: std::ios::out);
     if (!output_file)
     {
         std::cerr << "I can't write " << argv[1] << ".tokens ." << std::endl;
         return -1;
     }
 
-    std::string line;
-    for (int line_no = 1; std::getline(input_file, line); ++line_no)
+    // the tokens before an error are still written as text, while a binary
+    // file is left empty so it is never taken for the tokens of the source
+    evl_scanner scanner;
+    evl_tokens tokens;
+    bool ok = evl_get_scanner("auto", scanner)
+        && extract_tokens_in_chunks(source.begin(), source.end(), scanner, evl_default_threads(), tokens);
+    if (binary)
     {
-        for (size_t i = 0; i < line.size();)
-        {
-            // comments
-            if (line[i] == '/')
-            {
-                ++i;
-                if ((i == line.size()) || (line[i] != '/'))
-                {
-                    std::cerr << "LINE " << line_no
-                        << ": a single / is not allowed" << std::endl;
-                    return -1;
-                }
-                break; // skip the rest of the line by exiting the loop
-            }
-
-            // spaces
-            if ((line[i] == ' ') || (line[i] == '\t')
-                || (line[i] == '\r') || (line[i] == '\n'))
-            {
-                ++i; // skip this space character
-                continue; // skip the rest of the iteration
-            }
-
-            // SINGLE
-            if ((line[i] == '(') || (line[i] == ')')
-                || (line[i] == '[') || (line[i] == ']')
-                || (line[i] == ':') || (line[i] == ';')
-                || (line[i] == ',') || (line[i] == '=')
-		|| (line[i] == '{') || (line[i] == '}'))	// implemented "{","}","=" as a SINGLE
-            {
-                output_file << "SINGLE " << line[i] << std::endl;
-                ++i; // we consumed this character
-                continue; // skip the rest of the iteration
-            }
-
-            // NAME
-            if (((line[i] >= 'a') && (line[i] <= 'z'))       // a to z
-                || ((line[i] >= 'A') && (line[i] <= 'Z'))    // A to Z
-                || (line[i] == '_'))
-            {
-                size_t name_begin = i;
-                for (++i; i < line.size(); ++i)
-                {
-                    if (!(((line[i] >= 'a') && (line[i] <= 'z'))
-                        || ((line[i] >= 'A') && (line[i] <= 'Z'))
-			|| ((line[i] >= '0') && (line[i] <= '9'))
-                        || (line[i] == '_') || (line[i] == '$')))
-                    {
-                        break; // [name_begin, i) is the range for the token
-                    }
-                }
-                output_file << "NAME "
-                    << line.substr(name_begin, i-name_begin) << std::endl;
-		continue; // skip the rest of the iteration
-            }
-
-	    //NUMBER token implementation 
-	    if ((line[i] >= '0') && (line[i] <= '9'))    // 0 to 9 checks for tokens starting with any number
-            {
-                size_t number_begin = i; 
-                for (++i; i < line.size(); ++i)
-                {
-                    if (!((line[i] >= '0') && (line[i] <= '9')))
-                    {
-                        break; // [number_begin, i] is the range for the token
-                    }
-                }
-                output_file << "NUMBER "<< line.substr(number_begin, i-number_begin) << std::endl;
-            }
-
-            else
-            {
-                std::cerr << "LINE " << line_no
-                    << ": invalid character" << std::endl;
-                return -1;
-            }
-        }
+        if (ok)
+            store_binary_tokens(output_file, evl_hash(source.begin(), source.end()), tokens);
+        return ok? 0: -1;
+    }
+    for (evl_tokens::const_iterator it = tokens.begin(); it != tokens.end(); ++it)
+    {
+        if (it->type == evl_token::SINGLE)
+            output_file << "SINGLE ";
+        else if (it->type == evl_token::NAME)
+            output_file << "NAME ";
+        else
+            output_file << "NUMBER ";
+        output_file << it->str << '\n';
     }
 
-    return 0;
+    return ok? 0: -1;
 }
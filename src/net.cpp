@@ -4,31 +4,52 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <cstdio>
 #include <cstdlib>
 #include <string>
 #include <vector>
 #include <list>
 #include <stdexcept>
 #include <map>
-
-struct evl_token
+#include <set>
+#include <stdint.h>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+
+#include "evl_lexer.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define EVL_X86_KERNELS		// AVX2/AVX-512 gate kernels, picked at run time
+#include <immintrin.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define EVL_COMPILED		// engine=compiled, see sim_compiled
+#include <dlfcn.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
+
+// the tokens of a statement, consumed from the front
+struct evl_token_range
 {
-	enum token_type{NAME,NUMBER,SINGLE};
-	token_type type;
-	std::string str;
-	int line_no;
-}; //Structure Evl_token
-
-typedef std::list<evl_token> evl_tokens;
+	const evl_token *first, *last;
+	bool empty() const {return first == last;}
+	const evl_token &front() const {return *first;}
+	void pop_front() {++first;}
+}; //Structure evl_token_range
 
 struct evl_statement
 {
-	enum statement_type {MODULE,WIRE,COMPONENT,ENDMODULE};
+	enum statement_type {MODULE,WIRE,COMPONENT,ENDMODULE,ASSIGN};
 	statement_type type;
-	evl_tokens tokens;
+	evl_token_range tokens;
 }; //Structure evl_statement
 
-typedef std::list<evl_statement> evl_statements;
+typedef std::vector<evl_statement::statement_type> evl_statement_types;
 
 struct evl_pin
 {
@@ -46,13 +67,6 @@ struct evl_wire
 
 typedef std::list<evl_wire> evl_wires;
 
-struct evl_module
-{
-	std::string name;
-}; //Structure evl_module
-
-typedef std::list<evl_module>evl_modules;
-
 struct evl_component
 {
 	int NoPins;
@@ -62,163 +76,377 @@ struct evl_component
 
 typedef std::list<evl_component>evl_components;
 
-typedef std::map<std::string, int> evl_wires_table;
-evl_wires_table make_wires_table(const evl_wires &wires);
+struct evl_port
+{
+	std::string name;
+	bool output;
+}; //Structure evl_port
+
+typedef std::list<evl_port> evl_ports;
+
+// the ports of a module are also its first wires; a component whose type
+// is the name of a module is an instance of it
+struct evl_module
+{
+	std::string name;
+	evl_ports ports;
+	evl_wires wires;
+	evl_components components;
+}; //Structure evl_module
+
+typedef std::list<evl_module>evl_modules;
+
+// a run of whole statements, cut after a ';', parsed on its own thread; the
+// statements before its first module statement belong to the module open
+// where it starts, if any
+struct evl_chunk
+{
+	const char *begin, *end;
+	int line_no;	// of begin
+	evl_statement_types statement_types;
+	evl_module open;
+	evl_modules modules;
+	bool in_module;	// a module is open where the chunk starts, then where it ends
+	bool continued;	// has statements for the module open where it starts
+	bool ok;
+}; //Structure evl_chunk
+
+typedef std::vector<evl_chunk> evl_chunks;
 
 
 //defining all the classes for netlist
 class netlist;
-class gate;
-class net;
-class pin;
 
-
-class net{
+// kinds of gates, in the order used by the simulator's opcodes
+enum gate_kind {AND, OR, XOR, XNOR, NOT, BUF, TRIS, EVL_DFF, EVL_CLOCK, EVL_ONE, EVL_ZERO, EVL_INPUT, EVL_OUTPUT, EVL_LUT};
+
+// per-net signals of up to 64*words_ independent lanes, kept as two bit
+// planes with (value, unknown) being (0,0) for 0, (1,0) for 1, (0,1) for Z
+// and (1,1) for X
+struct sim_signals{
+	size_t words_;
+	std::vector <uint64_t> value_, unknown_;	// words_ words per net id
+	void resize(size_t num_nets, size_t words);
+	void fill(int net_id, char s);
+}; //Structure sim_signals
+
+// the nets of the pins of an evl_input, evl_output or evl_lut gate, copied
+// out of the netlist so the simulation state does not refer back to it
+struct sim_pins{
+	std::string name_;
+	std::vector <int> widths_;
+	std::vector <int> nets_begin_, nets_;	// nets of pin i are [nets_begin_[i], nets_begin_[i+1])
+	void create(const netlist &nl, int g);
+	void replace(const std::vector<int> &equivalents);
+}; //Structure sim_pins
+
+const size_t sim_block_size = 1 << 16;	// bytes read or written at a time
+const size_t sim_chunk_words = 1 << 10;	// gates times words per net given to a thread at a time
+
+// reads a file a block at a time and hands out its whitespace separated
+// fields, which stay valid until the next call
+class sim_reader{
 public:
-    	std::string n_name;
-	std::list <pin *> connections_;
-	std::map <std::string, net *> nets_table_;
-	void append_pin(pin *);
-}; //class net
-
-class pin{
+	sim_reader(): begin_(0), end_(0) {}
+	bool open(const std::string &file_name);
+	bool next(const char *&field, const char *&field_end);
+private:
+	std::ifstream file_;
+	std::vector <char> buffer_;
+	size_t begin_, end_;	// the bytes of buffer_ not handed out yet
+	bool fill();
+}; //class sim_reader
+
+// keeps the text of a file in a buffer written out a block at a time
+class sim_writer{
+public:
+	bool open(const std::string &file_name);
+	void put(char c) {buffer_.push_back(c); if (buffer_.size() >= sim_block_size) flush();}
+	void write(const std::string &s);
+	void flush();
+private:
+	std::ofstream file_;
+	std::vector <char> buffer_;
+}; //class sim_writer
+
+struct sim_input_lane{
+	sim_reader *file_;
+	int remaining_;				// cycles left for the current transition
+	std::vector <uint64_t> values_;		// current value of each pin, from words_begin_
+}; //Structure sim_input_lane
+
+struct sim_input{
+	sim_pins pins_;
+	std::vector <size_t> words_begin_;	// words of pin i in values_ start at words_begin_[i]
+	std::vector <sim_input_lane> lanes_;
+	bool open(const std::string &evl_file, size_t lanes);
+	bool read_next(size_t lane, sim_signals &signals);
+	void drive(sim_signals &signals, size_t lane) const;
+	void close();
+}; //Structure sim_input
+
+struct sim_output{
+	sim_pins pins_;
+	std::vector <sim_writer *> files_;	// one per lane
+	std::vector <uint64_t> trace_;		// packed signals of the cycles not written yet
+	bool open(const std::string &evl_file, size_t lanes);
+	void record(const sim_signals &signals);
+	void write_trace(const std::vector<uint64_t> &trace, size_t words);
+	void close();
+}; //Structure sim_output
+
+// the trace of one sim_output for a number of cycles, passed from the
+// simulation to the thread writing the files
+struct sim_trace_block{
+	size_t output;			// in netlist::outputs_, none_ to stop the writer
+	std::vector <uint64_t> trace;
+	static const size_t none_ = ~size_t(0);
+}; //Structure sim_trace_block
+
+// a lock-free ring of blocks between a single producer, which fills the
+// block from reserve and publishes it with push, and a single consumer,
+// which takes the block from front and releases it with pop; reserve waits
+// while all the blocks are taken so the simulation cannot run ahead of the
+// writer by more than the ring
+class sim_trace_ring{
 public:
-    	std::string net_name;
-    	int P_msb, P_lsb, length;
-	gate *gate_;
-	size_t pin_index_;
-	std::vector <net *> nets_;
-	bool create(gate *g, size_t pin_index, const evl_pin &p, const std::map<std::string, net *> &nets_table, const evl_wires_table &wires_table);
-}; //class pin
-
-class gate{
+	explicit sim_trace_ring(size_t size): blocks_(size), head_(0), tail_(0) {}
+	sim_trace_block &reserve();
+	void push() {tail_.store(tail_.load(std::memory_order_relaxed)+1, std::memory_order_release);}
+	sim_trace_block *front();
+	void pop() {head_.store(head_.load(std::memory_order_relaxed)+1, std::memory_order_release);}
+private:
+	std::vector <sim_trace_block> blocks_;
+	std::atomic <size_t> head_, tail_;	// blocks taken and published so far
+}; //class sim_trace_ring
+
+// the contents of an .evl_lut file, parsed once and then only read, so the
+// simulation of any number of lanes shares it
+struct sim_rom{
+	int width_, addr_width_;		// -1 until loaded
+	size_t stride_;				// 64-bit words per address
+	size_t size_;				// addresses given by the file
+	std::vector <uint64_t> bits_;
+	sim_rom(): width_(-1), addr_width_(-1), stride_(0), size_(0) {}
+	bool load(const std::string &file_name);
+	bool bit(size_t addr, int i) const {return (bits_[addr*stride_+i/64] >> (i%64)) & 1;}
+}; //Structure sim_rom
+
+struct sim_lut{
+	sim_pins pins_;				// data, then address
+	const sim_rom *rom_;
+	bool load(const std::string &evl_file, std::map<std::string, sim_rom> &roms);
+	void compute(sim_signals &signals, size_t lanes) const;
+}; //Structure sim_lut
+
+// one combinational operation of the levelized netlist: AND/OR/XOR/XNOR/NOT/BUF
+// read the operand nets and write the output net, TRIS resolves a bus from
+// (enable, data) operand pairs where an enable of -1 means a buf driver, and
+// EVL_LUT uses output as an index into sim_program::luts_
+struct sim_instruction{
+	gate_kind opcode;
+	int output;
+	size_t operands_begin, operands_end;
+}; //Structure sim_instruction
+
+// instructions of one level with the same opcode and operand count; the
+// operands of AND/OR/XOR/XNOR/NOT/BUF runs are stored operand-major for the
+// gate kernels, those of the other runs instruction by instruction
+struct sim_run{
+	gate_kind opcode;
+	size_t arity;
+	size_t first, count;	// instructions
+	size_t operands_begin;
+}; //Structure sim_run
+
+// the instructions [begin, end) of a run, the unit of work handed to a
+// thread; the chunks of a level can be evaluated in any order
+struct sim_chunk{
+	size_t run;
+	size_t begin, end;
+}; //Structure sim_chunk
+
+// the threads of a parallel simulation: run(begin, end) lets the calling
+// thread and the workers take task(c) for c in [begin, end) one at a time
+// until none is left, and returns once all of them are done, which makes
+// it a barrier between the levels; the workers sleep between two calls
+class sim_pool{
 public:
-    	std::string gate_type, gate_name;
-	std::vector <pin *> pins_;
-	typedef std::map <std::string, std::string> gates_table;
-	gates_table gatespredef;
-	bool create(const evl_component &component, const std::map <std::string, net *> &nets_table_, const evl_wires_table &wires_table);
-	bool create_pin(const evl_pin &ep, size_t pin_index, const std::map<std::string, net *> &nets_table, const evl_wires_table &wires_table);
-	bool validate_structural_semantics(std::string &gate_type, std::string &gate_name, const evl_pins &pins, gates_table &gatespredef);
-}; //class gate
-
+	sim_pool(size_t workers, const std::function<void(size_t)> &task);
+	~sim_pool();
+	void run(size_t begin, size_t end);
+private:
+	void work();
+	void worker();
+	std::function<void(size_t)> task_;
+	std::vector <std::thread> workers_;
+	size_t end_;
+	std::atomic <size_t> next_;		// first task not taken yet
+	std::mutex mutex_;			// guards the members below
+	std::condition_variable started_, finished_;
+	size_t done_;				// workers through with the current call
+	size_t generation_;			// calls to run so far
+	bool stop_;
+}; //class sim_pool
+
+// what changes from one event-driven evaluation to the next: an
+// instruction is marked dirty and queued in the bucket of its level once
+// one of its operands changed, and the nets no instruction computes are
+// compared with their values at the last evaluation
+struct sim_events{
+	std::vector <char> dirty;			// by instruction
+	std::vector <std::vector<int> > buckets;	// dirty instructions of each level
+	std::vector <uint64_t> sources;			// value then unknown words of each source net
+	std::vector <uint64_t> old;			// outputs of the instruction being evaluated
+	bool primed;					// all the instructions were evaluated once
+	sim_events(): primed(false) {}
+}; //Structure sim_events
+
+typedef void (*sim_kernel)(uint64_t *v, uint64_t *u, const int *outputs, const int *operands, size_t begin, size_t end, size_t count, size_t arity);
+
+class sim_program{
+public:
+	std::vector <sim_instruction> instructions_;	// ordered by level, opcode and operand count
+	std::vector <int> outputs_;			// output of each instruction
+	std::vector <int> operands_;			// net ids
+	std::vector <size_t> levels_;			// first instruction of each level, plus the end
+	std::vector <sim_run> runs_;
+	std::vector <sim_chunk> chunks_;		// runs cut by partition
+	std::vector <size_t> level_chunks_;		// first chunk of each level, plus the end
+	size_t chunk_size_;				// instructions
+	std::vector <sim_lut> luts_;
+	std::map <std::string, sim_rom> roms_;		// by file name
+	std::vector <size_t> instruction_runs_, instruction_levels_;	// filled in by prepare_events
+	std::vector <size_t> fanouts_begin_;		// net n is read by fanouts_[fanouts_begin_[n]...fanouts_begin_[n+1]-1]
+	std::vector <int> fanouts_;			// instructions
+	std::vector <int> sources_;			// nets read but not computed by the instructions
+	sim_kernel kernels_[BUF+1];			// indexed by opcode
+	std::vector <std::pair<int, char> > constants_;	// nets folded to a constant instead of computed
+	std::vector <int> equivalents_;			// the net computing the value of each net
+	size_t removed_gates_, removed_nets_;		// constant, duplicate or not observable
+
+	bool create(const netlist &nl);
+	bool select_kernels(size_t words, const std::string &isa);
+	void partition(size_t chunk_size);
+	bool parallel_level(size_t l) const;
+	template <size_t W> void execute_chunk(sim_signals &signals, size_t lanes, const sim_chunk &chunk) const;
+	template <size_t W> void execute(sim_signals &signals, size_t lanes, sim_pool *pool) const;
+	void prepare_events(size_t num_nets, sim_events &events);
+	template <size_t W> size_t execute_events(sim_signals &signals, size_t lanes, sim_events &events) const;
+private:
+	void instruction_outputs(size_t i, std::vector<int> &nets) const;
+	void instruction_operands(size_t i, std::vector<int> &nets) const;
+}; //class sim_program
+
+// the instructions of a program as straight-line C++, one block per
+// instruction and word, built into a shared object by the system compiler
+// and loaded; the object is kept next to the evl file under the hash of
+// the source it was built from, so only one built from the same source is
+// ever loaded
+class sim_compiled{
+public:
+	typedef void (*function)(uint64_t *v, uint64_t *u, void (*lut)(void *context, int i), void *context);
+	sim_compiled(): handle_(0), execute_(0) {}
+	~sim_compiled();
+	bool load(const std::string &evl_file, const sim_program &program, size_t words);
+	void execute(const sim_program &program, sim_signals &signals, size_t lanes) const;
+private:
+	static void generate(const sim_program &program, size_t words, std::string &source);
+	static bool compile(const std::string &cpp_file, const std::string &so_file);
+	bool open(const std::string &file_name, uint64_t source_hash);
+	void close();
+	void *handle_;
+	function execute_;
+}; //class sim_compiled
+
+// names stored back to back in one buffer, each ending with '\0' and
+// identified by its offset; they are all released together
+struct string_pool{
+	std::vector <char> chars_;
+	int add(const std::string &s);
+	const char *get(int offset) const {return &chars_[offset];}
+}; //Structure string_pool
+
+// the netlist is kept in flat arrays indexed by dense ids: wire w owns nets
+// [wire_nets_begin_[w], wire_nets_begin_[w+1]) from the LSB, gate g owns
+// pins [gate_pins_begin_[g], gate_pins_begin_[g+1]), pin p connects the nets
+// pin_nets_[pin_nets_begin_[p]...pin_nets_begin_[p+1]-1] from the LSB, and
+// net n fans out to the pins net_pins_[net_pins_begin_[n]...] in pin order
 class netlist{
 public:
-	std::list <gate *> gates_;
-	std::list <net *> nets_;
-	std::string net_name;
-	std::map <std::string, net *> nets_table_;
-
-	bool create(const evl_wires &wires, const evl_components &components, const evl_wires_table &wires_table);
+	string_pool names_;
+	std::vector <int> wire_names_;				// offsets in names_
+	std::vector <int> wire_nets_begin_;
+	std::vector <int> net_pins_begin_, net_pins_;
+	std::vector <int> net_drivers_begin_, net_drivers_;	// output pins, filled in by prepare_simulation
+	std::vector <int> net_sim_ids_;				// simulated net of each net, filled in by alias_nets
+	std::vector <int> sim_nets_;				// a net of each simulated net, for messages
+
+	std::vector <int> gate_types_, gate_names_;		// offsets in names_
+	std::vector <gate_kind> gate_kinds_;			// set by validate_structural_semantics
+	std::vector <int> gate_pins_begin_;
+
+	std::vector <int> pin_gates_;
+	std::vector <char> pin_dirs_;				// 'I' or 'O', set by validate_structural_semantics
+	std::vector <int> pin_nets_begin_, pin_nets_;
+
+	size_t num_nets() const {return wire_nets_begin_.back();}
+	size_t num_gates() const {return gate_types_.size();}
+	int gate_pin(int g, int i) const {return gate_pins_begin_[g]+i;}
+	int num_pins(int g) const {return gate_pins_begin_[g+1]-gate_pins_begin_[g];}
+	int pin_index(int p) const {return p-gate_pins_begin_[pin_gates_[p]];}
+	int pin_width(int p) const {return pin_nets_begin_[p+1]-pin_nets_begin_[p];}
+	int pin_net(int p, int i) const {return pin_nets_[pin_nets_begin_[p]+i];}
+	size_t num_sim_nets() const {return sim_nets_.size();}
+	int sim_net(int p, int i) const {return net_sim_ids_[pin_net(p, i)];}
+	int net_wire(int n) const {return int(std::upper_bound(wire_nets_begin_.begin(), wire_nets_begin_.end(), n)-wire_nets_begin_.begin())-1;}
+	std::string net_name(int n) const;
+	void display_net_name(std::ostream &out, int n) const;
+	const char *gate_type(int g) const {return names_.get(gate_types_[g]);}
+	const char *gate_name(int g) const {return names_.get(gate_names_[g]);}
+
+	bool create(const evl_modules &modules, std::string &top);
     	void display_netlist(std::ostream &out);
+	bool save(const std::string &file_name, uint64_t source_hash, const evl_modules &modules) const;
+	bool load(const std::string &file_name, uint64_t source_hash, evl_modules &modules);
+	bool simulate(const std::string &evl_file, int cycles, size_t lanes, const std::string &kernels, size_t threads,
+		const std::string &engine);
 
 private:
-	void create_net(std::string net_name);
-	bool create_nets(const evl_wires &wires);
-	bool create_gate(const evl_component &component, const evl_wires_table &wires_table);
-	bool create_gates(const evl_components &components, const evl_wires_table &wires_table);
+	typedef std::map<std::string, int> wires_table;	// wire ids by name, only kept while creating the netlist
+	typedef std::map<std::string, const evl_module *> modules_table;
+	typedef std::map<std::string, netlist> templates_table;	// elaborated modules by name
+	bool create_nets(const evl_wires &wires, wires_table &wire_ids);
+	void reserve(const evl_components &components, const wires_table &wire_ids);
+	bool find_pin_nets(const evl_pin &p, const wires_table &wire_ids, int &first, int &width) const;
+	void add_pin(int first, int width);
+	bool create_pin(const evl_pin &p, const wires_table &wire_ids);
+	bool create_gate(const evl_component &component, const wires_table &wire_ids);
+	bool create_assign(const evl_component &component, const wires_table &wire_ids);
+	bool create_instance(const evl_component &component, const netlist &child, const wires_table &wire_ids);
+	bool elaborate(const evl_module &module, const modules_table &module_ids,
+		templates_table &templates, std::set<std::string> &elaborating);
+	bool check_port_directions(const evl_module &module) const;
+	void create_fanouts();
+	bool valid_cache() const;
+	bool validate_structural_semantics(int g);
+	bool alias_nets();
+	bool prepare_simulation(const std::string &evl_file, size_t lanes, const std::string &kernels);
+	template <size_t W> bool run_simulation(const std::string &evl_file, int cycles, size_t lanes, size_t threads,
+		const std::string &engine);
+	void write_traces(sim_trace_ring *ring, size_t words);
+
+	int ports_;	// the first ports_ wires are the ports of a module
+	sim_program program_;
+	std::vector <sim_input> inputs_;
+	std::vector <sim_output> outputs_;
+	std::vector <int> dff_d_, dff_q_;	// D and Q nets of each evl_dff
+	sim_signals signals_;
+	std::vector <uint64_t> next_state_;	// D of each evl_dff, value then unknown words
 }; //class netlist
 
-std::string make_net_name(std::string wire_name, int i);
-
-bool extract_tokens_from_line(std::string line,int line_no, evl_tokens &tokens)
-{
-	for (size_t i = 0; i < line.size();)
-	{
-		if (line[i] == '/')
-		{
-			++i;
-			if ((i == line.size()) || (line[i] != '/'))
-			{
-				std::cerr << "LINE " << line_no	<< ": a single / is not allowed" << std::endl;
-				return false;
-			}
-			break;// skip the rest of the line by exiting the loop
-		}
-		else if (isspace(line[i]))
-		{
-		++i; // skip this space character
-		}
-		else if ((line[i] == '(') || (line[i] == ')')
-			|| (line[i] == '[') || (line[i] == ']')
-			|| (line[i] == ':') || (line[i] == ';')
-			|| (line[i] == ',') || (line[i] == '=')
-			|| (line[i] == '{') || (line[i] == '}'))	// implemented "{","}","=" as a SINGLE
-		{
-			evl_token token;
-			token.line_no=line_no;
-			token.type=evl_token::SINGLE;
-			token.str=std::string(1, line[i]);
-			tokens.push_back(token);
-			++i;
-		}
-		else if (((line[i] >= 'a') && (line[i] <= 'z'))       // a to z
-                        || ((line[i] >= 'A') && (line[i] <= 'Z'))    // A to Z
-                        || (line[i] == '_'))
-		{
-			size_t name_begin = i;
-			for (++i; i < line.size(); ++i)
-			{
-				if (!(((line[i] >= 'a') && (line[i] <= 'z'))
-				   || ((line[i] >= 'A') && (line[i] <= 'Z'))
-				   || ((line[i] >= '0') && (line[i] <= '9'))
-				   || (line[i] == '_') || (line[i] == '$')))
-				{
-					break;	// [name_begin, i] is the range for the token
-				}
-			}
-			evl_token token;
-			token.line_no=line_no;
-			token.type=evl_token::NAME;
-			token.str=line.substr(name_begin, i-name_begin);
-			tokens.push_back(token);
-		}
-		else if ((line[i] >= '0') && (line[i] <= '9')) // 0 to 9
-		{
-			size_t number_begin=i;
-			for (++i; i<line.size();++i)
-			{
-				if(!((line[i] >= '0') && (line[i] <= '9')))
-				{
-					break; 	// [number_begin, i] is the range for the token
-				}
-			}
-			evl_token token;
-			token.line_no=line_no;
-			token.type=evl_token::NUMBER;
-			token.str=line.substr(number_begin,i-number_begin);
-			tokens.push_back(token);
-		}
-		else
-		{
-			std::cerr << "LINE " << line_no	<< ": invalid character" << std::endl;
-			return false;
-		}
-	}
-	return true;
-}
-
-bool extract_tokens_from_file(std::string file_name, evl_tokens &tokens)
-{
-	std::ifstream input_file(file_name.c_str());
-	if (!input_file)
-	{
-		std::cerr << "Cannot read file: " << file_name << "." << std::endl;
-		return false;
-	}
-	tokens.clear();
-	std::string line;
-	for (int line_no = 1; std::getline(input_file, line); ++line_no)
-	{
-		if (!extract_tokens_from_line(line, line_no, tokens))
-		{
-			return false;
-		}
-	}
-	return true;
-}
-
-bool store_tokens_to_file(std::string file_name, const evl_tokens &tokens)
+// net does not keep the tokens, the file is only created
+bool store_tokens_to_file(std::string file_name)
 {
 		std::ofstream output_file(file_name.c_str());
 		if (!output_file)
@@ -229,107 +457,97 @@ bool store_tokens_to_file(std::string file_name, const evl_tokens &tokens)
 		return true;
 }
 
-bool token_is_semicolon(const evl_token &token)
+// groups the tokens pulled from an evl_lexer or an evl_token_decoder into
+// statements; only the tokens of the current statement are kept
+template <class Lexer> class evl_statement_reader
 {
-	if(token.str == ";")
-		return true;
-	else
-		return false;
-}
-
-bool move_tokens_to_statement(evl_tokens &statement_tokens,evl_tokens &tokens)
-{
-	assert(statement_tokens.empty());
-	assert(!tokens.empty());
-	evl_tokens::iterator next_sc = std::find_if(tokens.begin(), tokens.end(), token_is_semicolon);
-	if (next_sc == tokens.end())
-	{
-		std::cerr << "Din't find ';' reached the end of line. Aborting!!!!" <<std::endl;
-		return false;
-	}
-	++next_sc;
-	statement_tokens.splice(statement_tokens.begin(),tokens, tokens.begin(), next_sc);
-	return true;
-}
+public:
+	evl_statement_reader(Lexer &lexer, std::ostream &err)
+		: lexer_(lexer), err_(err), failed_(false) {}
 
-bool group_tokens_into_statements(evl_statements &statements ,evl_tokens &tokens)
-{
-	assert(statements.empty());
-	for (;!tokens.empty();)
+	// false at the end of the tokens or on an error; the tokens of s are
+	// valid until the next call
+	bool next(evl_statement &s)
 	{
-	// Generate one token per iteration
-		evl_token token=tokens.front();
-		if(token.type !=evl_token::NAME)
+		evl_token token;
+		if (!lexer_.next(token))
+			return false;
+		if (token.type != evl_token::NAME)
 		{
-			std::cerr<<"Need a NAME token but found '"<<token.str << "'on line"<<token.line_no<<std::endl;
+			err_<<"Need a NAME token but found '"<<token.str << "'on line"<<token.line_no<<std::endl;
+			failed_ = true;
 			return false;
 		}
-		if (token.str == "module")
-		{//module statement
-			evl_statement module;
-			module.type = evl_statement::MODULE;
-			if (!move_tokens_to_statement(module.tokens, tokens))
-				return false;
-			statements.push_back(module);
-		}
-		else if (token.str == "endmodule")
-		{//endmodule statement
-
-			evl_statement endmodule;
-			endmodule.type = evl_statement::ENDMODULE;
-			endmodule.tokens.push_back(token);
-			tokens.erase(tokens.begin());
-			statements.push_back(endmodule);;
-		}
-		else if (token.str == "wire")
-		{//wire statement
-			evl_statement wire;
-			wire.type = evl_statement::WIRE;
-			if (!move_tokens_to_statement(wire.tokens,tokens))
-				return false;
-			statements.push_back(wire);
+		tokens_.clear();
+		tokens_.push_back(token);
+		if (token.str == "endmodule")
+		{
+			s.type = evl_statement::ENDMODULE;
 		}
 		else
-		{//component statement
-			evl_statement component;
-			component.type = evl_statement::COMPONENT;
-			if (!move_tokens_to_statement(component.tokens,tokens))
-				return false;
-			statements.push_back(component);
+		{
+			s.type = (token.str == "module")? evl_statement::MODULE:
+				(token.str == "wire")? evl_statement::WIRE:
+				(token.str == "assign")? evl_statement::ASSIGN: evl_statement::COMPONENT;
+			do
+			{
+				if (!lexer_.next(token))
+				{
+					if (!lexer_.failed())
+						err_ << "Din't find ';' reached the end of line. Aborting!!!!" <<std::endl;
+					failed_ = true;
+					return false;
+				}
+				tokens_.push_back(token);
+			} while (!(token.str == ";"));
 		}
+		s.tokens.first = &tokens_[0];
+		s.tokens.last = s.tokens.first+tokens_.size();
+		return true;
 	}
-	return true;
-}
 
-void display_statements(std::ostream &out,const evl_statements &statements)
+	bool failed() const {return failed_ || lexer_.failed();}
+
+private:
+	Lexer &lexer_;
+	std::ostream &err_;
+	evl_tokens tokens_;
+	bool failed_;
+}; //class evl_statement_reader
+
+void display_statements(std::ostream &out,const evl_statement_types &statements, int &count)
 {
-	int count = 1;
-	for (evl_statements::const_iterator It = statements.begin();It != statements.end(); ++It, ++count) //right
-		{if ((*It).type == evl_statement::ENDMODULE)
+	for (evl_statement_types::const_iterator It = statements.begin();It != statements.end(); ++It, ++count) //right
+		{if ((*It) == evl_statement::ENDMODULE)
+			{
+				out << "statement " << count;
+				out << ": ENDMODULE" << '\n';
+			}
+			else if ((*It) == evl_statement::MODULE)
 			{
 				out << "statement " << count;
-				out << ": ENDMODULE" << std::endl;
+				out << ": MODULE" << '\n';
 			}
-			else if ((*It).type == evl_statement::MODULE)
+			else if ((*It) == evl_statement::WIRE)
 			{
 				out << "statement " << count;
-				out << ": MODULE" << std::endl;
+				out << ": WIRE" << '\n';
 			}
-			else if ((*It).type == evl_statement::WIRE)
+			else if ((*It) == evl_statement::ASSIGN)
 			{
 				out << "statement " << count;
-				out << ": WIRE" << std::endl;
+				out << ": ASSIGN" << '\n';
 			}
 			else //Remaining Component Module
 			{
 				out << "statement " << count;
-				out << ": COMPONENT" << std::endl;
+				out << ": COMPONENT" << '\n';
 
 			}
 		}
 }
 
-bool store_statements_to_file(std::string file_name,const evl_statements &statements)
+bool store_statements_to_file(std::string file_name,const evl_chunks &chunks)
 {
 
 	std::ofstream output_file(file_name.c_str());
@@ -338,30 +556,154 @@ bool store_statements_to_file(std::string file_name,const evl_statements &statem
 		std::cerr << "I can't write into file " << file_name << "." << std::endl;
 		return false;
 	}
-	display_statements(output_file, statements);
+	int count = 1;
+	for (evl_chunks::const_iterator it = chunks.begin(); it != chunks.end(); ++it)
+		display_statements(output_file, it->statement_types, count);
 	return true;
 }
 
 
-bool process_module_statement(evl_modules &modules,evl_statement &n)
+// module NAME; or module NAME(ports); where each port is input or output,
+// an optional [msb:0] and a NAME, and a port with only a NAME takes the
+// direction and width of the one before it
+bool process_module_statement(evl_module &module, evl_statement &s, std::ostream &err)
 {
-	assert(n.type == evl_statement::MODULE);
-	evl_module module;
-	for (; !n.tokens.empty(); n.tokens.pop_front())
-	{
-		evl_token t = n.tokens.front();
+	assert(s.type == evl_statement::MODULE);
+	enum state_type {INIT, MODULE, NAME, PORTS, DIR, BUS, BUS_MSB, BUS_COLON, BUS_LSB, BUS_DONE, PORT_NAME, PORTS_DONE, DONE};
 
-		if(t.type == evl_token::NAME)
+	state_type state = INIT;
+	evl_port port;
+	port.output = false;
+	int width = 1;
+	for (; !s.tokens.empty() && (state != DONE); s.tokens.pop_front())
+	{
+		const evl_token &t = s.tokens.front();
+		if (state == INIT)
 		{
-			module.name=t.str;
+			state = MODULE;
 		}
-		else
+		else if (state == MODULE)
 		{
-			break;
+			if (t.type != evl_token::NAME)
+			{
+				err << "Need NAME but found '" << t.str << "' on line " << t.line_no << std::endl;
+				return false;
+			}
+			module.name = t.str;
+			state = NAME;
 		}
-
+		else if (state == NAME)
+		{
+			if (t.str == ";")
+			{
+				state = DONE;
+			}
+			else if (t.str == "(")
+			{
+				state = PORTS;
+			}
+			else
+			{
+				err << "Need ';' or '(' but found '" << t.str << "' on line " << t.line_no << std::endl;
+				return false;
+			}
+		}
+		else if ((state == PORTS) || (state == DIR) || (state == BUS_DONE))
+		{
+			if ((state == PORTS) && ((t.str == "input") || (t.str == "output")))
+			{
+				port.output = (t.str == "output");
+				width = 1;
+				state = DIR;
+			}
+			else if ((state == DIR) && (t.str == "["))
+			{
+				state = BUS;
+			}
+			else if ((t.type == evl_token::NAME) && ((state != PORTS) || !module.ports.empty()))
+			{
+				port.name = t.str;
+				module.ports.push_back(port);
+				evl_wire wire;
+				wire.name = port.name;
+				wire.width = width;
+				module.wires.push_back(wire);
+				state = PORT_NAME;
+			}
+			else
+			{
+				err << "Need " << ((state == PORTS)? "'input' or 'output'": "NAME") << " but found '" << t.str << "' on line " << t.line_no << std::endl;
+				return false;
+			}
+		}
+		else if (state == BUS)
+		{
+			if (t.type != evl_token::NUMBER)
+			{
+				err << "Need NUMBER but found '" << t.str << "' on line " << t.line_no << std::endl;
+				return false;
+			}
+			width = atoi(std::string(t.str).c_str())+1;
+			state = BUS_MSB;
+		}
+		else if (state == BUS_MSB)
+		{
+			if (!(t.str == ":"))
+			{
+				err << "Need ':' but found '" << t.str << "' on line " << t.line_no << std::endl;
+				return false;
+			}
+			state = BUS_COLON;
+		}
+		else if (state == BUS_COLON)
+		{
+			if (!(t.str == "0"))
+			{
+				err << "Need '0' but found '" << t.str << "' on line " << t.line_no << std::endl;
+				return false;
+			}
+			state = BUS_LSB;
+		}
+		else if (state == BUS_LSB)
+		{
+			if (!(t.str == "]"))
+			{
+				err << "Need ']' but found '" << t.str << "' on line " << t.line_no << std::endl;
+				return false;
+			}
+			state = BUS_DONE;
+		}
+		else if (state == PORT_NAME)
+		{
+			if (t.str == ",")
+			{
+				state = PORTS;
+			}
+			else if (t.str == ")")
+			{
+				state = PORTS_DONE;
+			}
+			else
+			{
+				err << "Need ',' or ')' but found '" << t.str << "' on line " << t.line_no << std::endl;
+				return false;
+			}
+		}
+		else if (state == PORTS_DONE)
+		{
+			if (!(t.str == ";"))
+			{
+				err << "Need ';' but found '" << t.str << "' on line " << t.line_no << std::endl;
+				return false;
+			}
+			state = DONE;
+		}
+	}
+	if (!s.tokens.empty() || (state != DONE))
+	{
+		err << "something wrong with the Statement" << std::endl;
+		return false;
 	}
-	modules.push_back(module);
 	return true;
 }
 
@@ -370,12 +712,12 @@ void display_modules(std::ostream &out, const evl_modules &modules)
 
 	for (evl_modules::const_iterator it = modules.begin();	it != modules.end(); ++it)
 	{
-		out << "module"  <<" "<< it->name<<" "<< /*wires.size()<<" "<<comps.size()<<*/std::endl;
+		out << "module"  <<" "<< it->name<<" "<< /*wires.size()<<" "<<comps.size()<<*/'\n';
 	}
 
 }
 
-bool process_wire_statement(evl_wires &wires, evl_statement &s)
+bool process_wire_statement(evl_wires &wires, evl_statement &s, std::ostream &err)
 {
 	assert(s.type == evl_statement::WIRE);
 	enum state_type {INIT, WIRE, DONE, WIRES, WIRE_NAME,BUS,BUS_MSB,BUS_COLON,BUS_LSB,BUS_DONE};
@@ -384,14 +726,14 @@ bool process_wire_statement(evl_wires &wires, evl_statement &s)
 	int Bus_length = 1;
 	for (; !s.tokens.empty() && (state != DONE); s.tokens.pop_front())
 	{
-		evl_token t = s.tokens.front();
+		const evl_token &t = s.tokens.front();
 		if (state == INIT)
 		{
 			if (t.str == "wire") {
 				state = WIRE;
 			}
 			else {
-				std::cerr << "Need 'wire' but found '" << t.str
+				err << "Need 'wire' but found '" << t.str
 					<< "' on line " << t.line_no << std::endl;
 				return false;
 			}
@@ -413,7 +755,7 @@ bool process_wire_statement(evl_wires &wires, evl_statement &s)
 			}
 
 			else {
-				std::cerr << "Need NAME but found '" << t.str
+				err << "Need NAME but found '" << t.str
 					<< "' on line " << t.line_no << std::endl;
 				return false;
 			}
@@ -432,7 +774,7 @@ bool process_wire_statement(evl_wires &wires, evl_statement &s)
 
 		else
 			{
-				std::cerr << "Need NAME but found '" << t.str
+				err << "Need NAME but found '" << t.str
 					<< "' on line " << t.line_no << std::endl;
 				return false;
 			}
@@ -449,7 +791,7 @@ bool process_wire_statement(evl_wires &wires, evl_statement &s)
 			}
 			else
 			{
-				std::cerr << "Need ',' or ';' but found '" << t.str
+				err << "Need ',' or ';' but found '" << t.str
 					<< "' on line " << t.line_no << std::endl;
 				return false;
 			}
@@ -458,13 +800,13 @@ bool process_wire_statement(evl_wires &wires, evl_statement &s)
 		{
 			if (t.type == evl_token::NUMBER)
 			{
-				Bus_length = atoi(t.str.c_str())+1;
+				Bus_length = atoi(std::string(t.str).c_str())+1;
 				state = BUS_MSB;
 			}
 			else
 			{
 
-			std::cerr << "Need NUMBER but found '" << t.str<< "' on line " << t.line_no << std::endl;
+			err << "Need NUMBER but found '" << t.str<< "' on line " << t.line_no << std::endl;
 				return false;
 			}
 		}
@@ -476,7 +818,7 @@ bool process_wire_statement(evl_wires &wires, evl_statement &s)
 			}
 			else
 			{
-				std::cerr << "Need ':' but found '" << t.str<< "' on line " << t.line_no << std::endl;
+				err << "Need ':' but found '" << t.str<< "' on line " << t.line_no << std::endl;
 				return false;
 			}
 		}
@@ -488,7 +830,7 @@ bool process_wire_statement(evl_wires &wires, evl_statement &s)
 			}
 			else
 			{
-				std::cerr << "Need '0' but found '" << t.str<< "' on line " << t.line_no << std::endl;
+				err << "Need '0' but found '" << t.str<< "' on line " << t.line_no << std::endl;
 				return false;
 			}
 		}
@@ -500,7 +842,7 @@ bool process_wire_statement(evl_wires &wires, evl_statement &s)
 			}
 			else
 			{
-				std::cerr << "Need ']' but found '" << t.str<< "' on line " << t.line_no << std::endl;
+				err << "Need ']' but found '" << t.str<< "' on line " << t.line_no << std::endl;
 				return false;
 			}
 		}
@@ -516,7 +858,7 @@ bool process_wire_statement(evl_wires &wires, evl_statement &s)
 			}
 			else
 			{
-				std::cerr << "Need NAME but found '" << t.str<< "' on line " << t.line_no << std::endl;
+				err << "Need NAME but found '" << t.str<< "' on line " << t.line_no << std::endl;
 				return false;
 			}
 		}
@@ -527,7 +869,7 @@ bool process_wire_statement(evl_wires &wires, evl_statement &s)
 	}
 	if (!s.tokens.empty() || (state != DONE))
 	{
-		std::cerr << "something wrong with the Statement" << std::endl;
+		err << "something wrong with the Statement" << std::endl;
 		return false;
 	}
 	return true;
@@ -535,14 +877,14 @@ bool process_wire_statement(evl_wires &wires, evl_statement &s)
 
 void display_wires(std::ostream &out,const evl_wires &wires )
 {
-out<<"wires"<<" "<<wires.size()<<std::endl;
+out<<"wires"<<" "<<wires.size()<<'\n';
 	for (evl_wires::const_iterator iter = wires.begin();iter != wires.end(); ++iter)
 	{
-		out << "  wire " << iter->name << " " << iter->width<<std::endl;
+		out << "  wire " << iter->name << " " << iter->width<<'\n';
 	}
 }
 
-bool process_Component_Statement(evl_components &components,evl_statement &s)
+bool process_Component_Statement(evl_components &components,evl_statement &s, std::ostream &err)
 {
 	assert((!(s.type == evl_statement::WIRE))&&(!(s.type == evl_statement::MODULE))&&(!(s.type == evl_statement::ENDMODULE)));
 	enum state_type {INIT, TYPE, NAME, PINS, PIN_NAME,BUS,BUS_MSB,BUS_COLON,BUS_LSB,BUS_DONE,PINS_DONE,DONE};
@@ -554,7 +896,7 @@ bool process_Component_Statement(evl_components &components,evl_statement &s)
 
 	for (; !s.tokens.empty() && (state != DONE); s.tokens.pop_front())
 	{
-		evl_token t = s.tokens.front();
+		const evl_token &t = s.tokens.front();
 							//  Starts computation with INIT state
 		if (state == INIT)
 		{
@@ -565,7 +907,7 @@ bool process_Component_Statement(evl_components &components,evl_statement &s)
                                 state = TYPE;
 			}
 			else {
-				std::cerr << "Need NAME but found '" << t.str<< "' on line " << t.line_no << std::endl;
+				err << "Need NAME but found '" << t.str<< "' on line " << t.line_no << std::endl;
 				return false;
 			}
 		}
@@ -582,7 +924,7 @@ bool process_Component_Statement(evl_components &components,evl_statement &s)
 				state = PINS;
 			}
 			else {
-				std::cerr << "Need NAME or '(' but found '" << t.str<< "' on line " << t.line_no << std::endl;
+				err << "Need NAME or '(' but found '" << t.str<< "' on line " << t.line_no << std::endl;
 				return false;
 			}
 		}
@@ -594,7 +936,7 @@ bool process_Component_Statement(evl_components &components,evl_statement &s)
 				state = PINS;
 			}
 			else {
-				std::cerr << "Need '(' but found '" << t.str<< "' on line " << t.line_no << std::endl;
+				err << "Need '(' but found '" << t.str<< "' on line " << t.line_no << std::endl;
 				return false;
 			}
 		}
@@ -613,7 +955,7 @@ bool process_Component_Statement(evl_components &components,evl_statement &s)
 
 		else
 			{
-				std::cerr << "Need NAME but found '" << t.str<< "' on line " << t.line_no << std::endl;
+				err << "Need NAME but found '" << t.str<< "' on line " << t.line_no << std::endl;
 				return false;
 			}
 		}
@@ -639,7 +981,7 @@ bool process_Component_Statement(evl_components &components,evl_statement &s)
 			}
 			else
 			{
-				std::cerr << "Need ',' or ')' or '[' but found " << t.str<< "' on line " << t.line_no <<std::endl;
+				err << "Need ',' or ')' or '[' but found " << t.str<< "' on line " << t.line_no <<std::endl;
 				return false;
 			}
 
@@ -648,13 +990,13 @@ bool process_Component_Statement(evl_components &components,evl_statement &s)
 		{
 			if (t.type == evl_token::NUMBER)
 			{
-				pin.bus_msb = atoi(t.str.c_str());
+				pin.bus_msb = atoi(std::string(t.str).c_str());
 
 				state = BUS_MSB;
 			}
 			else
 			{
-				std::cerr << "Need NUMBER but found '" << t.str	<< "' on line " << t.line_no << std::endl;
+				err << "Need NUMBER but found '" << t.str	<< "' on line " << t.line_no << std::endl;
 				return false;
 			}
 		}
@@ -671,7 +1013,7 @@ bool process_Component_Statement(evl_components &components,evl_statement &s)
 			}
 			else
 			{
-				std::cerr << "Need ':' or ']' but found " << t.str<< "' on line " << t.line_no << std::endl;
+				err << "Need ':' or ']' but found " << t.str<< "' on line " << t.line_no << std::endl;
 				return false;
 			}
 		}
@@ -680,12 +1022,12 @@ bool process_Component_Statement(evl_components &components,evl_statement &s)
 		{
 			if (t.type == evl_token::NUMBER)
 			{
-				pin.bus_lsb = atoi(t.str.c_str());
+				pin.bus_lsb = atoi(std::string(t.str).c_str());
 				state = BUS_LSB;
 			}
 			else
 			{
-				std::cerr << "Need NUMBER but found '" << t.str	<< "' on line " << t.line_no << std::endl;
+				err << "Need NUMBER but found '" << t.str	<< "' on line " << t.line_no << std::endl;
 				return false;
 			}
 		}
@@ -698,7 +1040,7 @@ bool process_Component_Statement(evl_components &components,evl_statement &s)
 			}
 			else
 			{
-				std::cerr << "Need ']' but found '" << t.str<< "' on line " << t.line_no << std::endl;
+				err << "Need ']' but found '" << t.str<< "' on line " << t.line_no << std::endl;
 				return false;
 			}
 		}
@@ -721,7 +1063,7 @@ bool process_Component_Statement(evl_components &components,evl_statement &s)
 			}
 			else
 			{
-				std::cerr << "Need ')' or ',' but found '" << t.str<< "' on line " << t.line_no << std::endl;
+				err << "Need ')' or ',' but found '" << t.str<< "' on line " << t.line_no << std::endl;
 				return false;
 			}
 }
@@ -734,7 +1076,7 @@ bool process_Component_Statement(evl_components &components,evl_statement &s)
 			else
 			{
 
-			std::cerr << "Need ';' but found '" << t.str<< "' on line " << t.line_no << std::endl;
+			err << "Need ';' but found '" << t.str<< "' on line " << t.line_no << std::endl;
 				return false;
 			}
 
@@ -754,296 +1096,2860 @@ bool process_Component_Statement(evl_components &components,evl_statement &s)
 
 	if (!s.tokens.empty() || (state != DONE))
 	{
-		std::cerr << "something wrong with the Statement" << std::endl;
+		err << "something wrong with the Statement" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// assign PIN = PIN; where a PIN is NAME, NAME[bit] or NAME[msb:lsb], kept as
+// an unnamed "assign" component with the two pins
+bool process_assign_statement(evl_components &components, evl_statement &s, std::ostream &err)
+{
+	assert(s.type == evl_statement::ASSIGN);
+	enum state_type {INIT, PIN, PIN_NAME, BUS, BUS_MSB, BUS_COLON, BUS_LSB, PIN_DONE, DONE};
+
+	state_type state = INIT;
+	evl_component cmp;
+	cmp.type = "assign";
+	cmp.NoPins = 2;
+	evl_pin pin;
+	for (; !s.tokens.empty() && (state != DONE); s.tokens.pop_front())
+	{
+		const evl_token &t = s.tokens.front();
+		const char *end = cmp.pins.empty()? "=": ";";	// ends the current pin
+		if (state == INIT)
+		{
+			state = PIN;
+		}
+		else if (state == PIN)
+		{
+			if (t.type != evl_token::NAME)
+			{
+				err << "Need NAME but found '" << t.str << "' on line " << t.line_no << std::endl;
+				return false;
+			}
+			pin.name = t.str;
+			pin.bus_msb = -1;
+			pin.bus_lsb = -1;
+			state = PIN_NAME;
+		}
+		else if ((state == PIN_NAME) && (t.str == "["))
+		{
+			state = BUS;
+		}
+		else if ((state == BUS) || (state == BUS_COLON))
+		{
+			if (t.type != evl_token::NUMBER)
+			{
+				err << "Need NUMBER but found '" << t.str << "' on line " << t.line_no << std::endl;
+				return false;
+			}
+			(state == BUS? pin.bus_msb: pin.bus_lsb) = atoi(std::string(t.str).c_str());
+			state = (state == BUS)? BUS_MSB: BUS_LSB;
+		}
+		else if ((state == BUS_MSB) && (t.str == ":"))
+		{
+			state = BUS_COLON;
+		}
+		else if (((state == BUS_MSB) || (state == BUS_LSB)) && (t.str == "]"))
+		{
+			state = PIN_DONE;
+		}
+		else if (((state == PIN_NAME) || (state == PIN_DONE)) && (t.str == end))
+		{
+			cmp.pins.push_back(pin);
+			state = (cmp.pins.size() == 2)? DONE: PIN;
+		}
+		else
+		{
+			std::string expected = (state == BUS_MSB)? "':' or ']'": (state == BUS_LSB)? "']'":
+				(state == PIN_NAME)? std::string("'[' or '")+end+"'": std::string("'")+end+"'";
+			err << "Need " << expected << " but found '" << t.str << "' on line " << t.line_no << std::endl;
+			return false;
+		}
+	}
+	if (!s.tokens.empty() || (state != DONE))
+	{
+		err << "something wrong with the Statement" << std::endl;
 		return false;
 	}
+	components.push_back(cmp);
 	return true;
 }
 
 void display_components(std::ostream &out,const evl_components &components )
 {
 	evl_components::const_iterator iter = components.begin();
-	out << "components " << std::distance(components.begin(),components.end()) << std::endl;
+	out << "components " << std::distance(components.begin(),components.end()) << '\n';
 	for (;	iter != components.end(); ++iter)
 	{
 		if (iter->name == "")
 		{
-		out << "  component " <<iter->type<< " "<<iter->pins.size()<<std::endl;
+		out << "  component " <<iter->type<< " "<<iter->pins.size()<<'\n';
 		}
 		else
 
-		out << "  component " <<iter->type<< " "<<iter->name<<" "<<iter->pins.size()<<std::endl;
+		out << "  component " <<iter->type<< " "<<iter->name<<" "<<iter->pins.size()<<'\n';
 		for(evl_pins::const_iterator It=iter-> pins.begin();It!=iter->pins.end();++It)
 		{
 			if (It->bus_msb == -1 &&It->bus_lsb ==-1)
 			{
-			out<<"    pin"<<" "<<It->name<< std::endl;
+			out<<"    pin"<<" "<<It->name<< '\n';
 			}
 			else if (It->bus_msb != -1 &&It->bus_lsb == -1)
 			{
-                        out<<"    pin"<<" "<<It->name<<*" "<<It->bus_msb << std::endl;
+                        out<<"    pin"<<" "<<It->name<<*" "<<It->bus_msb << '\n';
 			}
 			else
-                        out<<"    pin"<<" "<<It->name<<*" "<<It->bus_msb <<" "<<It->bus_lsb<< std::endl;
+                        out<<"    pin"<<" "<<It->name<<*" "<<It->bus_msb <<" "<<It->bus_lsb<< '\n';
 		}
 	}
 }
 
-evl_wires_table make_wires_table(const evl_wires &wires) {
-        evl_wires_table wires_table;
-        for (evl_wires::const_iterator it = wires.begin(); it != wires.end(); ++it) {
-                evl_wires_table::iterator same_name = wires_table.find(it->name);
-                if(same_name != wires_table.end()){
-                    std::cerr << "Wire '" << it->name << "' is already defined" << std::endl;
-                    throw std::runtime_error("Multiple Wire Definitions");
-                }
-                wires_table.insert(std::make_pair(it->name, it->width));
-        }
-        return wires_table;
-}
-
-//netlist implementation start
-std::string make_net_name(std::string wire_name, int i){
-	assert(i >= 0);
-	std::ostringstream oss;
-	oss << wire_name << "[" << i << "]";
-	return oss.str();
-}
-
-void netlist::create_net(std::string net_name){
-	assert(nets_table_.find(net_name) == nets_table_.end());
-	net *n = new net;
-    	(*n).n_name = net_name;
-	nets_table_[net_name] = n;
-	nets_.push_back(n);
-}
-
-bool netlist::create_nets(const evl_wires &wires){
-	for (evl_wires::const_iterator it = wires.begin(); it != wires.end(); it++){
-		if (it->width == 1){
-			create_net(it->name);
-		}
-		else{
-			for (int i = 0; i < (it->width); ++i){
-				create_net(make_net_name(it->name, i));
-        	    	}
+// groups and processes the statements of a chunk one at a time as their
+// tokens are pulled; after endmodule they are still grouped, but not
+// processed
+template <class Lexer> bool parse_statements(Lexer &lexer, evl_chunk &chunk, bool keep_statements, std::ostream &err)
+{
+	evl_statement_reader<Lexer> reader(lexer, err);
+	evl_module *module = chunk.in_module? &chunk.open: 0;
+	chunk.continued = false;
+	for (evl_statement s; reader.next(s);)
+	{
+		if (keep_statements)
+			chunk.statement_types.push_back(s.type);
+		const evl_token &t = s.tokens.front();
+		if (s.type == evl_statement::MODULE)
+		{
+			if (module != 0)
+			{
+				err << "Need 'endmodule' but found 'module' on line " << t.line_no << std::endl;
+				return false;
+			}
+			chunk.modules.push_back(evl_module());
+			module = &chunk.modules.back();
+			if (!process_module_statement(*module, s, err))
+				return false;
+			continue;
 		}
+		if (module == 0)
+		{
+			err << "Need 'module' but found '" << t.str << "' on line " << t.line_no << std::endl;
+			return false;
+		}
+		chunk.continued = chunk.continued || (module == &chunk.open);
+		if (s.type == evl_statement::WIRE)
+		{
+			if (!process_wire_statement(module->wires, s, err))
+				return false;
+		}
+		else if (s.type == evl_statement::ASSIGN)
+		{
+			if (!process_assign_statement(module->components, s, err))
+				return false;
+		}
+		else if (s.type == evl_statement::COMPONENT)
+		{
+			if (!process_Component_Statement(module->components, s, err))
+				return false;
+		}
+		else
+		{
+			module = 0;
+		}
+	}
+	chunk.in_module = (module != 0);
+	return !reader.failed();
+}
+
+bool parse_chunk(evl_chunk &chunk, const evl_scanner &scanner, bool keep_statements, std::ostream &err)
+{
+	evl_lexer lexer(chunk.begin, chunk.end, scanner, chunk.line_no, err);
+	return parse_statements(lexer, chunk, keep_statements, err);
+}
+
+// the tokens of a binary .tokens file are parsed as a single chunk
+bool parse_tokens(evl_token_decoder &decoder, bool keep_statements, evl_chunks &chunks)
+{
+	chunks.resize(1);
+	chunks[0].in_module = false;
+	return chunks[0].ok = parse_statements(decoder, chunks[0], keep_statements, std::cerr);
+}
+
+// large sources are parsed on up to threads threads in chunks of at least
+// 256 KB cut after a ';', all but the first assuming they start inside a
+// module; from the first chunk that fails or made the wrong assumption, the
+// rest of the source is parsed again on this thread, so the first error in
+// the file is the one reported, with its real line number; the statement
+// types are only kept for the .statements file
+bool parse_source(const evl_source &source, size_t threads, bool keep_statements, evl_chunks &chunks)
+{
+	evl_scanner scanner;
+	if (!evl_get_scanner("auto", scanner))
+		return false;
+	std::vector<const char *> bounds = evl_split_source(source.begin(), source.end(), threads, 256*1024);
+	size_t n = bounds.size()-1;
+	chunks.resize(n);
+	std::vector<int> lines(n, 0);
+	evl_parallel_for(n, threads, [&](size_t i) {
+		std::ostream quiet(0);
+		evl_chunk &chunk = chunks[i];
+		chunk.begin = bounds[i];
+		chunk.end = bounds[i+1];
+		chunk.line_no = 1;
+		chunk.in_module = (i != 0);
+		chunk.ok = parse_chunk(chunk, scanner, keep_statements, (n == 1)? std::cerr: quiet);
+		lines[i] = evl_count_lines(chunk.begin, chunk.end);
+	});
+	int line_no = 1;
+	evl_module *open = 0;	// the module open after the chunks so far
+	for (size_t i = 0; i < n; ++i)
+	{
+		if (!chunks[i].ok || ((open == 0) && chunks[i].continued))
+		{
+			if (n == 1)
+				return false;
+			n = i+1;
+			chunks.resize(i);
+			chunks.resize(n);
+			evl_chunk &rest = chunks[i];
+			rest.begin = bounds[i];
+			rest.end = source.end();
+			rest.line_no = line_no;
+			rest.in_module = (open != 0);
+			if (!(rest.ok = parse_chunk(rest, scanner, keep_statements, std::cerr)))
+				return false;
+		}
+		evl_chunk &chunk = chunks[i];
+		if (chunk.continued)
+		{
+			open->wires.splice(open->wires.end(), chunk.open.wires);
+			open->components.splice(open->components.end(), chunk.open.components);
+		}
+		if (!chunk.in_module)
+			open = 0;
+		else if (!chunk.modules.empty())
+			open = &chunk.modules.back();
+		line_no += lines[i];
+	}
+	return true;
+}
+
+// the modules of the chunks in file order
+void join_chunks(evl_chunks &chunks, evl_modules &modules)
+{
+	for (evl_chunks::iterator it = chunks.begin(); it != chunks.end(); ++it)
+	{
+		modules.splice(modules.end(), it->modules);
+	}
+}
+
+//netlist implementation start
+int string_pool::add(const std::string &s){
+	int offset = int(chars_.size());
+	chars_.insert(chars_.end(), s.begin(), s.end());
+	chars_.push_back('\0');
+	return offset;
+}
+
+// a net of a bus is named after its wire and bit, e.g. "w[17]", only when
+// it is printed
+std::string netlist::net_name(int n) const{
+	std::ostringstream oss;
+	display_net_name(oss, n);
+	return oss.str();
+}
+
+void netlist::display_net_name(std::ostream &out, int n) const{
+	int w = net_wire(n);
+	out << names_.get(wire_names_[w]);
+	if (wire_nets_begin_[w+1]-wire_nets_begin_[w] > 1)
+		out << "[" << n-wire_nets_begin_[w] << "]";
+}
+
+bool netlist::create_nets(const evl_wires &wires, wires_table &wire_ids){
+	size_t chars = 0;
+	for (evl_wires::const_iterator it = wires.begin(); it != wires.end(); ++it){
+		chars += it->name.size()+1;
+	}
+	names_.chars_.reserve(chars);
+	wire_names_.reserve(wires.size());
+	wire_nets_begin_.reserve(wires.size()+1);
+	wire_nets_begin_.assign(1, 0);
+	for (evl_wires::const_iterator it = wires.begin(); it != wires.end(); ++it){
+		if (!wire_ids.insert(std::make_pair(it->name, int(wire_names_.size()))).second){
+			std::cerr << "Wire '" << it->name << "' is already defined" << std::endl;
+			return false;
+		}
+		wire_names_.push_back(names_.add(it->name));
+		wire_nets_begin_.push_back(wire_nets_begin_.back()+it->width);
+	}
+	return true;
+}
+
+// size the gate and pin arrays once from the parsed components so that
+// creating the netlist does not reallocate them
+void netlist::reserve(const evl_components &components, const wires_table &wire_ids){
+	size_t gates = 0, pins = 0, pin_nets = 0, chars = names_.chars_.size();
+	for (evl_components::const_iterator it = components.begin(); it != components.end(); ++it){
+		++gates;
+		chars += it->type.size()+it->name.size()+2;
+		for (evl_pins::const_iterator itp = it->pins.begin(); itp != it->pins.end(); ++itp){
+			++pins;
+			wires_table::const_iterator itw = wire_ids.find(itp->name);
+			if (itp->bus_msb == -1)
+				pin_nets += (itw == wire_ids.end())? 1: wire_nets_begin_[itw->second+1]-wire_nets_begin_[itw->second];
+			else
+				pin_nets += (itp->bus_lsb == -1)? 1: std::max(itp->bus_msb-itp->bus_lsb+1, 1);
+		}
+	}
+	names_.chars_.reserve(chars);
+	gate_types_.reserve(gates);
+	gate_names_.reserve(gates);
+	gate_kinds_.reserve(gates);
+	gate_pins_begin_.reserve(gates+1);
+	pin_gates_.reserve(pins);
+	pin_dirs_.reserve(pins);
+	pin_nets_begin_.reserve(pins+1);
+	pin_nets_.reserve(pin_nets);
+}
+
+// the nets of a pin are contiguous: bit i of wire w is net
+// wire_nets_begin_[w]+i
+bool netlist::find_pin_nets(const evl_pin &p, const wires_table &wire_ids, int &first, int &width) const{
+    	wires_table::const_iterator itrwire = wire_ids.find(p.name);
+	if (itrwire == wire_ids.end()){
+		std::cerr << "Wire '" << p.name << "' is not defined" << std::endl;
+		return false;
+	}
+	int base = wire_nets_begin_[itrwire->second], wire_width = wire_nets_begin_[itrwire->second+1]-base;
+	if ((p.bus_msb >= wire_width) || ((p.bus_msb != -1) && (wire_width == 1))){
+		std::cerr << "Wire '" << p.name << "' has no bit " << p.bus_msb << std::endl;
+		return false;
+	}
+	if ((p.bus_lsb != -1) && (p.bus_lsb > p.bus_msb)){
+		std::cerr << "Wire '" << p.name << "' has an invalid range" << std::endl;
+		return false;
+	}
+
+	int lsb = 0, msb = wire_width-1;	// the whole wire
+	if (p.bus_msb != -1){
+		msb = p.bus_msb;
+		lsb = (p.bus_lsb == -1)? p.bus_msb: p.bus_lsb;
+	}
+	first = base+lsb;
+	width = msb-lsb+1;
+	return true;
+}
+
+// the pin belongs to the last gate created
+void netlist::add_pin(int first, int width){
+	for (int i = 0; i < width; ++i){
+		pin_nets_.push_back(first+i);
+	}
+	pin_gates_.push_back(int(gate_types_.size())-1);
+	pin_dirs_.push_back('I');
+	pin_nets_begin_.push_back(int(pin_nets_.size()));
+}
+
+bool netlist::create_pin(const evl_pin &p, const wires_table &wire_ids){
+	int first, width;
+	if (!find_pin_nets(p, wire_ids, first, width))
+		return false;
+	add_pin(first, width);
+	return true;
+}
+
+bool netlist::create_gate(const evl_component &component, const wires_table &wire_ids){
+	if (component.type == "assign")
+		return create_assign(component, wire_ids);
+	gate_types_.push_back(names_.add(component.type));
+	gate_names_.push_back(names_.add(component.name));
+	gate_kinds_.push_back(AND);	// see validate_structural_semantics
+	for (evl_pins::const_iterator it = component.pins.begin(); it != component.pins.end(); ++it){
+		if (!create_pin(*it, wire_ids))
+			return false;
+	}
+	gate_pins_begin_.push_back(int(pin_gates_.size()));
+ 	return true;
+}
+
+// assign lhs = rhs; becomes an unnamed buf per bit
+bool netlist::create_assign(const evl_component &component, const wires_table &wire_ids){
+	int lhs_first, lhs_width, rhs_first, rhs_width;
+	if (!find_pin_nets(component.pins.front(), wire_ids, lhs_first, lhs_width)
+		|| !find_pin_nets(component.pins.back(), wire_ids, rhs_first, rhs_width))
+		return false;
+	if (lhs_width != rhs_width){
+		std::cerr << "Assign to '" << component.pins.front().name << "' needs " << lhs_width
+			<< " bits but has " << rhs_width << std::endl;
+		return false;
+	}
+	int type = names_.add("buf"), name = names_.add("");
+	for (int i = 0; i < lhs_width; ++i){
+		gate_types_.push_back(type);
+		gate_names_.push_back(name);
+		gate_kinds_.push_back(AND);
+		add_pin(lhs_first+i, 1);
+		add_pin(rhs_first+i, 1);
+		gate_pins_begin_.push_back(int(pin_gates_.size()));
+	}
+	return true;
+}
+
+// copies the elaborated child module into this netlist: its ports take the
+// nets of the pins, its other wires and its gates are prefixed with the
+// instance name, e.g. "a1.carry"
+bool netlist::create_instance(const evl_component &component, const netlist &child, const wires_table &wire_ids){
+	if (component.name.empty()){
+		std::cerr << "Instance of module '" << component.type << "' needs a name" << std::endl;
+		return false;
+	}
+	if (int(component.pins.size()) != child.ports_){
+		std::cerr << "Instance '" << component.name << "' needs " << child.ports_
+			<< " pins but has " << component.pins.size() << std::endl;
+		return false;
+	}
+	std::vector<int> nets(child.num_nets());	// child net to net
+	int w = 0;
+	for (evl_pins::const_iterator it = component.pins.begin(); it != component.pins.end(); ++it, ++w){
+		int first, width, port_width = child.wire_nets_begin_[w+1]-child.wire_nets_begin_[w];
+		if (!find_pin_nets(*it, wire_ids, first, width))
+			return false;
+		if (width != port_width){
+			std::cerr << "Port '" << child.names_.get(child.wire_names_[w]) << "' of instance '" << component.name
+				<< "' needs " << port_width << " bits but has " << width << std::endl;
+			return false;
+		}
+		for (int i = 0; i < width; ++i){
+			nets[child.wire_nets_begin_[w]+i] = first+i;
+		}
+	}
+	std::string prefix = component.name+".";
+	for (size_t cw = child.ports_; cw+1 < child.wire_nets_begin_.size(); ++cw){
+		wire_names_.push_back(names_.add(prefix+child.names_.get(child.wire_names_[cw])));
+		for (int n = child.wire_nets_begin_[cw]; n != child.wire_nets_begin_[cw+1]; ++n){
+			nets[n] = wire_nets_begin_.back()+n-child.wire_nets_begin_[cw];
+		}
+		wire_nets_begin_.push_back(wire_nets_begin_.back()+child.wire_nets_begin_[cw+1]-child.wire_nets_begin_[cw]);
+	}
+	int pins = int(pin_gates_.size()), gates = int(gate_types_.size());
+	for (size_t g = 0; g < child.num_gates(); ++g){
+		const char *name = child.gate_name(int(g));
+		gate_types_.push_back(names_.add(child.gate_type(int(g))));
+		gate_names_.push_back(names_.add((*name == '\0')? std::string(): prefix+name));
+		gate_kinds_.push_back(child.gate_kinds_[g]);
+		gate_pins_begin_.push_back(pins+child.gate_pins_begin_[g+1]);
+	}
+	for (size_t p = 0; p < child.pin_gates_.size(); ++p){
+		pin_gates_.push_back(gates+child.pin_gates_[p]);
+		pin_dirs_.push_back(child.pin_dirs_[p]);
+		for (int i = child.pin_nets_begin_[p]; i != child.pin_nets_begin_[p+1]; ++i){
+			pin_nets_.push_back(nets[child.pin_nets_[i]]);
+		}
+		pin_nets_begin_.push_back(int(pin_nets_.size()));
+	}
+	return true;
+}
+
+// each module is elaborated once into a template that its instances copy;
+// elaborating holds the modules being elaborated to catch recursion
+bool netlist::elaborate(const evl_module &module, const modules_table &module_ids,
+	templates_table &templates, std::set<std::string> &elaborating){
+	wires_table wire_ids;
+	if (!create_nets(module.wires, wire_ids))
+		return false;
+	ports_ = int(module.ports.size());
+	reserve(module.components, wire_ids);
+	gate_pins_begin_.assign(1, 0);
+	pin_nets_begin_.assign(1, 0);
+	elaborating.insert(module.name);
+	for (evl_components::const_iterator itr = module.components.begin(); itr != module.components.end(); ++itr){
+		modules_table::const_iterator itm = module_ids.find(itr->type);
+		if (itm == module_ids.end()){
+			int first = int(num_gates());
+			if (!create_gate(*itr, wire_ids))
+				return false;
+			for (int g = first; g < int(num_gates()); ++g){
+				if (!validate_structural_semantics(g))	// for the pin directions
+					return false;
+			}
+			continue;
+		}
+		if (elaborating.count(itr->type)){
+			std::cerr << "Module '" << itr->type << "' instantiates itself" << std::endl;
+			return false;
+		}
+		templates_table::iterator itt = templates.find(itr->type);
+		if (itt == templates.end()){
+			itt = templates.insert(std::make_pair(itr->type, netlist())).first;
+			if (!itt->second.elaborate(*itm->second, module_ids, templates, elaborating))
+				return false;
+		}
+		if (!create_instance(*itr, itt->second, wire_ids))
+			return false;
+	}
+	elaborating.erase(module.name);
+	return check_port_directions(module);
+}
+
+// an input port is only driven from outside its module and an output port
+// only from inside, so an instance cannot drive a net its parent drives
+bool netlist::check_port_directions(const evl_module &module) const{
+	std::vector<char> driven(num_nets(), 0);
+	for (size_t p = 0; p < pin_gates_.size(); ++p){
+		for (int i = 0; (pin_dirs_[p] == 'O') && (i < pin_width(int(p))); ++i){
+			driven[pin_net(int(p), i)] = 1;
+		}
+	}
+	int w = 0;
+	for (evl_ports::const_iterator it = module.ports.begin(); it != module.ports.end(); ++it, ++w){
+		for (int n = wire_nets_begin_[w]; n != wire_nets_begin_[w+1]; ++n){
+			if (it->output && !driven[n]){
+				std::cerr << "Output port '" << it->name << "' of module '" << module.name << "' is not driven inside it" << std::endl;
+				return false;
+			}
+			if (!it->output && driven[n]){
+				std::cerr << "Input port '" << it->name << "' of module '" << module.name << "' is driven inside it" << std::endl;
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// counting sort of the pin nets by net, so each net lists its pins in the
+// order they were created
+void netlist::create_fanouts(){
+	net_pins_begin_.assign(num_nets()+1, 0);
+	for (size_t i = 0; i < pin_nets_.size(); ++i){
+		++net_pins_begin_[pin_nets_[i]+1];
+	}
+	for (size_t n = 0; n < num_nets(); ++n){
+		net_pins_begin_[n+1] += net_pins_begin_[n];
+	}
+	std::vector<int> next(net_pins_begin_.begin(), net_pins_begin_.end()-1);
+	net_pins_.resize(pin_nets_.size());
+	for (size_t p = 0; p+1 < pin_nets_begin_.size(); ++p){
+		for (int i = pin_nets_begin_[p]; i != pin_nets_begin_[p+1]; ++i){
+			net_pins_[next[pin_nets_[i]]++] = int(p);
+		}
+	}
+}
+
+// the top module is the one no other module instantiates; the netlist is
+// the top module with all the instances flattened into it
+bool netlist::create(const evl_modules &modules, std::string &top){
+	modules_table module_ids;
+	for (evl_modules::const_iterator it = modules.begin(); it != modules.end(); ++it){
+		if (!module_ids.insert(std::make_pair(it->name, &*it)).second){
+			std::cerr << "Module '" << it->name << "' is already defined" << std::endl;
+			return false;
+		}
+	}
+	std::set<std::string> instantiated;
+	for (evl_modules::const_iterator it = modules.begin(); it != modules.end(); ++it){
+		for (evl_components::const_iterator itc = it->components.begin(); itc != it->components.end(); ++itc){
+			if (module_ids.count(itc->type))
+				instantiated.insert(itc->type);
+		}
+	}
+	const evl_module *top_module = 0;
+	for (evl_modules::const_iterator it = modules.begin(); it != modules.end(); ++it){
+		if (instantiated.count(it->name))
+			continue;
+		if (top_module != 0){
+			std::cerr << "Modules '" << top_module->name << "' and '" << it->name << "' are both top modules" << std::endl;
+			return false;
+		}
+		top_module = &*it;
+	}
+	if (top_module == 0){
+		std::cerr << "There is no top module" << std::endl;
+		return false;
+	}
+	top = top_module->name;
+	templates_table templates;
+	std::set<std::string> elaborating;
+	if (!elaborate(*top_module, module_ids, templates, elaborating))
+		return false;
+	create_fanouts();
+	return true;
+}
+
+void netlist::display_netlist(std::ostream &out){
+
+	out << "nets " << num_nets() << '\n';
+	for (size_t n = 0; n < num_nets(); ++n){
+		out << "  net ";
+		display_net_name(out, int(n));
+		out << " " << net_pins_begin_[n+1]-net_pins_begin_[n] << '\n';
+		for (int i = net_pins_begin_[n]; i != net_pins_begin_[n+1]; ++i){
+			int p = net_pins_[i], g = pin_gates_[p];
+			if (*gate_name(g) == '\0'){
+				out << "    " << gate_type(g) << " " << pin_index(p) << '\n';
+			}
+			else{
+				out << "    " << gate_type(g) << " " << gate_name(g) << " " << pin_index(p) << '\n';
+			}
+		}
+	}
+
+	out << "components " << num_gates() << '\n';
+	for (size_t g = 0; g < num_gates(); ++g){
+		if (*gate_name(g) == '\0'){
+		    out << "  component " << gate_type(g) << " " << num_pins(g) << '\n';
+		}
+		else{
+		    out << "  component " << gate_type(g) << " " << gate_name(g) << " " << num_pins(g) << '\n';
+		}
+		for (int p = gate_pins_begin_[g]; p != gate_pins_begin_[g+1]; ++p){
+            out << "    pin " << pin_width(p);
+            for (int i = 0; i < pin_width(p); ++i){
+                out << " ";
+                display_net_name(out, pin_net(p, i));
+            }
+            out << '\n';
+		}
+	}
+}
+
+// the .evlb cache of a netlist: a header with the hash of the source and
+// of the payload, then the module names and every array of the netlist as
+// a count followed by the elements, as laid out in memory by the build that
+// wrote it
+struct evlb_header{
+	char magic[4];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t reserved;
+	uint64_t source_hash;
+	uint64_t payload_hash;
+}; //Structure evlb_header
+
+const uint32_t evlb_version = 3;
+
+template <class T> void evlb_write(std::ostream &out, const std::vector<T> &v){
+	uint64_t n = v.size();
+	out.write((const char *)&n, sizeof(n));
+	if (n != 0)
+		out.write((const char *)&v[0], std::streamsize(n*sizeof(T)));
+}
+
+template <class T> bool evlb_read(const char *&p, const char *end, std::vector<T> &v){
+	uint64_t n;
+	if (size_t(end-p) < sizeof(n))
+		return false;
+	memcpy(&n, p, sizeof(n));
+	p += sizeof(n);
+	if (n > size_t(end-p)/sizeof(T))
+		return false;
+	v.resize(size_t(n));
+	if (n != 0)
+		memcpy(&v[0], p, size_t(n)*sizeof(T));
+	p += n*sizeof(T);
+	return true;
+}
+
+// begin holds the offsets of consecutive ranges covering [0, size)
+bool evlb_valid_ranges(const std::vector<int> &begin, size_t size){
+	if (begin.empty() || (begin[0] != 0) || (size_t(begin.back()) != size))
+		return false;
+	for (size_t i = 1; i < begin.size(); ++i){
+		if (begin[i] < begin[i-1])
+			return false;
+	}
+	return true;
+}
+
+bool evlb_valid_ids(const std::vector<int> &ids, size_t limit){
+	for (size_t i = 0; i < ids.size(); ++i){
+		if ((ids[i] < 0) || (size_t(ids[i]) >= limit))
+			return false;
+	}
+	return true;
+}
+
+// written to a temporary file first, so a run never maps a partial cache
+bool netlist::save(const std::string &file_name, uint64_t source_hash, const evl_modules &modules) const{
+	std::string temp_name = file_name+".tmp";
+	std::ofstream out(temp_name.c_str(), std::ios::out | std::ios::binary);
+	if (!out)
+		return false;
+	std::ostringstream payload;
+	std::vector <char> module_names;
+	for (evl_modules::const_iterator it = modules.begin(); it != modules.end(); ++it){
+		module_names.insert(module_names.end(), it->name.begin(), it->name.end());
+		module_names.push_back('\0');
+	}
+	evlb_write(payload, module_names);
+	evlb_write(payload, names_.chars_);
+	evlb_write(payload, wire_names_);
+	evlb_write(payload, wire_nets_begin_);
+	evlb_write(payload, net_pins_begin_);
+	evlb_write(payload, net_pins_);
+	evlb_write(payload, gate_types_);
+	evlb_write(payload, gate_names_);
+	evlb_write(payload, gate_kinds_);
+	evlb_write(payload, gate_pins_begin_);
+	evlb_write(payload, pin_gates_);
+	evlb_write(payload, pin_dirs_);
+	evlb_write(payload, pin_nets_begin_);
+	evlb_write(payload, pin_nets_);
+	std::string bytes = payload.str();
+	evlb_header header = {{'E', 'V', 'L', 'B'}, evlb_version, 0x01020304, 0, source_hash,
+		evl_hash(bytes.data(), bytes.data()+bytes.size())};
+	out.write((const char *)&header, sizeof(header));
+	out.write(bytes.data(), std::streamsize(bytes.size()));
+	out.close();
+	if (!out || (std::rename(temp_name.c_str(), file_name.c_str()) != 0)){
+		std::remove(temp_name.c_str());
+		return false;
+	}
+	return true;
+}
+
+// false, quietly, when there is no cache or it is stale or damaged
+bool netlist::load(const std::string &file_name, uint64_t source_hash, evl_modules &modules){
+	if (!std::ifstream(file_name.c_str()))
+		return false;
+	evl_source cache;
+	if (!cache.open(file_name))
+		return false;
+	const char *p = cache.begin(), *end = cache.end();
+	evlb_header header;
+	if (size_t(end-p) < sizeof(header))
+		return false;
+	memcpy(&header, p, sizeof(header));
+	p += sizeof(header);
+	if ((memcmp(header.magic, "EVLB", 4) != 0) || (header.version != evlb_version)
+		|| (header.byte_order != 0x01020304) || (header.source_hash != source_hash)
+		|| (header.payload_hash != evl_hash(p, end)))
+		return false;
+	std::vector <char> module_names;
+	if (!evlb_read(p, end, module_names)
+		|| !evlb_read(p, end, names_.chars_)
+		|| !evlb_read(p, end, wire_names_)
+		|| !evlb_read(p, end, wire_nets_begin_)
+		|| !evlb_read(p, end, net_pins_begin_)
+		|| !evlb_read(p, end, net_pins_)
+		|| !evlb_read(p, end, gate_types_)
+		|| !evlb_read(p, end, gate_names_)
+		|| !evlb_read(p, end, gate_kinds_)
+		|| !evlb_read(p, end, gate_pins_begin_)
+		|| !evlb_read(p, end, pin_gates_)
+		|| !evlb_read(p, end, pin_dirs_)
+		|| !evlb_read(p, end, pin_nets_begin_)
+		|| !evlb_read(p, end, pin_nets_)
+		|| (p != end) || (!module_names.empty() && (module_names.back() != '\0'))
+		|| names_.chars_.empty() || (names_.chars_.back() != '\0') || wire_nets_begin_.empty() || (net_pins_begin_.size() != num_nets()+1)
+		|| (gate_pins_begin_.size() != num_gates()+1) || (pin_nets_begin_.size() != pin_gates_.size()+1)
+		|| !valid_cache())
+		return false;
+	for (size_t i = 0; i < module_names.size(); i += modules.back().name.size()+1){
+		modules.push_back(evl_module());
+		modules.back().name = &module_names[i];
+	}
+	return true;
+}
+
+// every id and range read from a cache is checked before it is used to
+// index another array, so a damaged cache is parsed again instead
+bool netlist::valid_cache() const{
+	size_t pins = pin_gates_.size();
+	if (!evlb_valid_ranges(wire_nets_begin_, num_nets()) || !evlb_valid_ranges(net_pins_begin_, net_pins_.size())
+		|| !evlb_valid_ranges(gate_pins_begin_, pins) || !evlb_valid_ranges(pin_nets_begin_, pin_nets_.size())
+		|| (wire_names_.size()+1 != wire_nets_begin_.size()) || (gate_names_.size() != num_gates())
+		|| (gate_kinds_.size() != num_gates()) || (pin_dirs_.size() != pins)
+		|| !evlb_valid_ids(wire_names_, names_.chars_.size()) || !evlb_valid_ids(gate_types_, names_.chars_.size())
+		|| !evlb_valid_ids(gate_names_, names_.chars_.size()) || !evlb_valid_ids(net_pins_, pins)
+		|| !evlb_valid_ids(pin_gates_, num_gates()) || !evlb_valid_ids(pin_nets_, num_nets()))
+		return false;
+	for (size_t g = 0; g < num_gates(); ++g){
+		if ((gate_kinds_[g] < AND) || (gate_kinds_[g] > EVL_LUT))
+			return false;
+		for (int p = gate_pins_begin_[g]; p != gate_pins_begin_[g+1]; ++p){
+			if (pin_gates_[p] != int(g))
+				return false;
+		}
+	}
+	for (size_t p = 0; p < pins; ++p){
+		if ((pin_dirs_[p] != 'I') && (pin_dirs_[p] != 'O'))
+			return false;
+	}
+	for (size_t n = 0; n < num_nets(); ++n){
+		for (int i = net_pins_begin_[n]; i != net_pins_begin_[n+1]; ++i){
+			std::vector<int>::const_iterator first = pin_nets_.begin()+pin_nets_begin_[net_pins_[i]];
+			std::vector<int>::const_iterator last = pin_nets_.begin()+pin_nets_begin_[net_pins_[i]+1];
+			if (std::find(first, last, int(n)) == last)
+				return false;	// not a fanout of the net
+		}
+	}
+	return true;
+}
+
+//netlist end
+
+//simulation start
+int hex_digit_value(char c){
+	if ((c >= '0') && (c <= '9'))
+		return c - '0';
+	if ((c >= 'a') && (c <= 'f'))
+		return c - 'a' + 10;
+	if ((c >= 'A') && (c <= 'F'))
+		return c - 'A' + 10;
+	return -1;
+}
+
+void sim_signals::resize(size_t num_nets, size_t words){
+	words_ = words;
+	value_.assign(num_nets*words, 0);
+	unknown_.assign(num_nets*words, 0);
+}
+
+void sim_signals::fill(int net_id, char s){
+	for (size_t i = net_id*words_; i < (net_id+1)*words_; ++i){
+		value_[i] = ((s == '1') || (s == 'X'))? ~uint64_t(0): 0;
+		unknown_[i] = ((s == 'X') || (s == 'Z'))? ~uint64_t(0): 0;
+	}
+}
+
+// with several lanes, lane i uses "<evl_file>.<name>.<i>.<ext>"
+std::string sim_file_name(const std::string &evl_file, const std::string &gate_name, size_t lanes, size_t lane, const char *ext){
+	std::ostringstream oss;
+	oss << evl_file << "." << gate_name;
+	if (lanes > 1)
+		oss << "." << lane;
+	oss << "." << ext;
+	return oss.str();
+}
+
+bool sim_reader::open(const std::string &file_name){
+	file_.open(file_name.c_str(), std::ios::in | std::ios::binary);
+	return bool(file_);
+}
+
+// moves the bytes not handed out yet to the front and reads at least a
+// block after them
+bool sim_reader::fill(){
+	std::copy(buffer_.begin()+begin_, buffer_.begin()+end_, buffer_.begin());
+	end_ -= begin_;
+	begin_ = 0;
+	if (buffer_.size() < end_+sim_block_size)
+		buffer_.resize(end_+sim_block_size);
+	file_.read(&buffer_[end_], std::streamsize(buffer_.size()-end_));
+	end_ += size_t(file_.gcount());
+	return file_.gcount() > 0;
+}
+
+bool sim_reader::next(const char *&field, const char *&field_end){
+	for (;;){
+		for (; (begin_ != end_) && isspace((unsigned char)buffer_[begin_]); ++begin_);
+		if (begin_ != end_)
+			break;
+		if (!fill())
+			return false;
+	}
+	size_t i = begin_;
+	for (;;){
+		for (; (i != end_) && !isspace((unsigned char)buffer_[i]); ++i);
+		if (i != end_)
+			break;
+		size_t length = i-begin_;
+		bool more = fill();
+		i = begin_+length;
+		if (!more)
+			break;	// the last field of the file
+	}
+	field = &buffer_[begin_];
+	field_end = field+(i-begin_);
+	begin_ = i;
+	return true;
+}
+
+bool sim_writer::open(const std::string &file_name){
+	file_.open(file_name.c_str(), std::ios::out | std::ios::binary);
+	buffer_.reserve(sim_block_size);
+	return bool(file_);
+}
+
+void sim_writer::write(const std::string &s){
+	for (size_t i = 0; i < s.size(); ++i){
+		put(s[i]);
+	}
+}
+
+void sim_writer::flush(){
+	if (!buffer_.empty())
+		file_.write(&buffer_[0], std::streamsize(buffer_.size()));
+	buffer_.clear();
+}
+
+bool parse_decimal(const char *begin, const char *end, int &value){
+	value = 0;
+	for (const char *p = begin; p != end; ++p){
+		if ((*p < '0') || (*p > '9') || (value > 214748363))
+			return false;
+		value = value*10+(*p-'0');
+	}
+	return begin != end;
+}
+
+// the hex digits from the MSB into width bits from the LSB, dropping the
+// digits above width
+bool parse_hex(const char *begin, const char *end, int width, uint64_t *bits){
+	std::fill(bits, bits+(width+63)/64, uint64_t(0));
+	for (const char *digit = end; digit != begin; ){
+		int value = hex_digit_value(*--digit), bit = int(end-digit-1)*4;
+		if (value == -1)
+			return false;
+		if (bit < width)
+			bits[bit/64] |= uint64_t(value) << (bit%64);
+	}
+	if (width%64 != 0)
+		bits[(width-1)/64] &= (uint64_t(1) << (width%64))-1;
+	return begin != end;
+}
+
+bool netlist::validate_structural_semantics(int g){
+	std::string gate_type = netlist::gate_type(g);
+	int num_outputs = 1, pins = num_pins(g);
+	gate_kind &kind = gate_kinds_[g];
+	if ((gate_type == "and") || (gate_type == "or") || (gate_type == "xor") || (gate_type == "xnor")){
+		kind = (gate_type == "and")? AND: (gate_type == "or")? OR: (gate_type == "xor")? XOR: XNOR;
+		if (pins < 3){
+			std::cerr << "Gate '" << gate_type << "' needs at least three pins" << std::endl;
+			return false;
+		}
+	}
+	else if ((gate_type == "not") || (gate_type == "buf")){
+		kind = (gate_type == "not")? NOT: BUF;
+		if (pins != 2){
+			std::cerr << "Gate '" << gate_type << "' needs two pins" << std::endl;
+			return false;
+		}
+	}
+	else if ((gate_type == "tris") || (gate_type == "evl_dff")){
+		kind = (gate_type == "tris")? TRIS: EVL_DFF;
+		if (pins != 3){
+			std::cerr << "Gate '" << gate_type << "' needs three pins" << std::endl;
+			return false;
+		}
+	}
+	else if (gate_type == "evl_clock"){
+		kind = EVL_CLOCK;
+		if (pins != 1){
+			std::cerr << "Gate '" << gate_type << "' needs a single pin" << std::endl;
+			return false;
+		}
+	}
+	else if ((gate_type == "evl_one") || (gate_type == "evl_zero") || (gate_type == "evl_input") || (gate_type == "evl_output")){
+		kind = (gate_type == "evl_one")? EVL_ONE: (gate_type == "evl_zero")? EVL_ZERO: (gate_type == "evl_input")? EVL_INPUT: EVL_OUTPUT;
+		num_outputs = (kind == EVL_OUTPUT)? 0: pins;
+		if (pins == 0){
+			std::cerr << "Gate '" << gate_type << "' needs at least one pin" << std::endl;
+			return false;
+		}
+	}
+	else if (gate_type == "evl_lut"){
+		kind = EVL_LUT;
+		if (pins != 2){
+			std::cerr << "Gate '" << gate_type << "' needs two pins" << std::endl;
+			return false;
+		}
+	}
+	else{
+		std::cerr << "Gate type '" << gate_type << "' is not supported" << std::endl;
+		return false;
+	}
+
+	if (((kind == EVL_INPUT) || (kind == EVL_OUTPUT) || (kind == EVL_LUT)) && (*gate_name(g) == '\0')){
+		std::cerr << "Gate '" << gate_type << "' needs a name" << std::endl;
+		return false;
+	}
+	for (int i = 0; i < pins; ++i){
+		if ((kind <= EVL_CLOCK) && (pin_width(gate_pin(g, i)) != 1)){
+			std::cerr << "Pin " << i << " of gate '" << gate_type << "' must be 1 bit wide" << std::endl;
+			return false;
+		}
+		pin_dirs_[gate_pin(g, i)] = (i < num_outputs)? 'O': 'I';
+	}
+	return true;
+}
+
+void sim_pins::create(const netlist &nl, int g){
+	name_ = nl.gate_name(g);
+	nets_begin_.assign(1, 0);
+	for (int i = 0; i < nl.num_pins(g); ++i){
+		int p = nl.gate_pin(g, i);
+		widths_.push_back(nl.pin_width(p));
+		for (int j = 0; j < nl.pin_width(p); ++j){
+			nets_.push_back(nl.sim_net(p, j));
+		}
+		nets_begin_.push_back(int(nets_.size()));
+	}
+}
+
+void sim_pins::replace(const std::vector<int> &equivalents){
+	for (size_t i = 0; i < nets_.size(); ++i){
+		nets_[i] = equivalents[nets_[i]];
+	}
+}
+
+bool sim_output::open(const std::string &evl_file, size_t lanes){
+	std::ostringstream header;
+	header << pins_.widths_.size() << '\n';
+	for (size_t i = 0; i < pins_.widths_.size(); ++i){
+		header << pins_.widths_[i] << '\n';
+	}
+	for (size_t lane = 0; lane < lanes; ++lane){
+		std::string file_name = sim_file_name(evl_file, pins_.name_, lanes, lane, "evl_output");
+		sim_writer *output_file = new sim_writer;
+		files_.push_back(output_file);
+		if (!output_file->open(file_name)){
+			std::cerr << "I can't write into file " << file_name << "." << std::endl;
+			return false;
+		}
+		output_file->write(header.str());
+	}
+	return true;
+}
+
+void sim_output::close(){
+	for (size_t i = 0; i < files_.size(); ++i){
+		files_[i]->flush();
+		delete files_[i];
+	}
+	files_.clear();
+	trace_.clear();
+}
+
+bool sim_input::open(const std::string &evl_file, size_t lanes){
+	words_begin_.assign(1, 0);
+	for (size_t i = 0; i < pins_.widths_.size(); ++i){
+		words_begin_.push_back(words_begin_.back()+(pins_.widths_[i]+63)/64);
+	}
+	for (size_t lane = 0; lane < lanes; ++lane){
+		std::string file_name = sim_file_name(evl_file, pins_.name_, lanes, lane, "evl_input");
+		sim_input_lane input;
+		input.file_ = new sim_reader;
+		input.remaining_ = 0;
+		input.values_.assign(words_begin_.back(), 0);
+		lanes_.push_back(input);
+		if (!input.file_->open(file_name)){
+			std::cerr << "Cannot read file: " << file_name << "." << std::endl;
+			return false;
+		}
+		const char *field, *field_end;
+		int num_pins = 0;
+		if (!input.file_->next(field, field_end) || !parse_decimal(field, field_end, num_pins)
+			|| (size_t(num_pins) != pins_.widths_.size())){
+			std::cerr << file_name << ": invalid number of pins" << std::endl;
+			return false;
+		}
+		for (int i = 0; i < num_pins; ++i){
+			int width = 0;
+			if (!input.file_->next(field, field_end) || !parse_decimal(field, field_end, width)
+				|| (width != pins_.widths_[i])){
+				std::cerr << file_name << ": invalid width for pin " << i << std::endl;
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+void sim_input::close(){
+	for (size_t i = 0; i < lanes_.size(); ++i){
+		delete lanes_[i].file_;
+	}
+	lanes_.clear();
+}
+
+// the words of an .evl_lut file are read straight from the mapped file, the
+// header first, and packed from the LSB at stride_ 64-bit words per address;
+// digits above the data width are ignored, and an address must fit a size_t
+// as sim_lut::compute gathers it into one
+bool sim_rom::load(const std::string &file_name){
+	evl_source source;
+	if (!source.open(file_name)){
+		return false;
+	}
+	const char *p = source.begin(), *end = source.end();
+	int header[2] = {-1, -1};
+	for (int h = 0; h < 2; ++h){
+		for (; (p != end) && isspace((unsigned char)*p); ++p);
+		int value = 0;
+		const char *digits = p;
+		for (; (p != end) && (*p >= '0') && (*p <= '9') && (value < 65536); ++p){
+			value = value*10+(*p-'0');
+		}
+		if ((p == digits) || ((p != end) && !isspace((unsigned char)*p))){
+			std::cerr << file_name << ": needs the data and address widths first" << std::endl;
+			return false;
+		}
+		header[h] = value;
+	}
+	if (header[1] >= int(sizeof(size_t)*8)){
+		std::cerr << file_name << ": address width " << header[1] << " exceeds " << sizeof(size_t)*8-1 << " bits" << std::endl;
+		return false;
+	}
+	width_ = header[0];
+	addr_width_ = header[1];
+	stride_ = (width_+63)/64;
+	size_t addresses = (addr_width_ < 32)? size_t(1) << addr_width_: ~size_t(0);
+	bits_.reserve(stride_*std::min(addresses, size_t(1) << 20));
+	for (size_ = 0; size_ < addresses; ++size_){
+		for (; (p != end) && isspace((unsigned char)*p); ++p);
+		const char *word = p;
+		for (; (p != end) && !isspace((unsigned char)*p); ++p);
+		if (word == p)
+			break;
+		bits_.resize(bits_.size()+stride_, 0);
+		uint64_t *entry = &bits_[bits_.size()-stride_];
+		for (const char *digit = p; digit != word; ){
+			int value = hex_digit_value(*--digit), bit = int(p-digit-1)*4;
+			if (value == -1){
+				std::cerr << file_name << ": invalid word '" << std::string(word, p) << "'" << std::endl;
+				return false;
+			}
+			if (bit < width_)
+				entry[bit/64] |= uint64_t(value) << (bit%64);
+		}
+		if (width_%64 != 0)
+			entry[stride_-1] &= (uint64_t(1) << (width_%64))-1;
+	}
+	return true;
+}
+
+// the evl_lut gates reading the same file share its sim_rom
+bool sim_lut::load(const std::string &evl_file, std::map<std::string, sim_rom> &roms){
+	std::string file_name = evl_file + "." + pins_.name_ + ".evl_lut";
+	std::map<std::string, sim_rom>::iterator it = roms.find(file_name);
+	if (it == roms.end()){
+		it = roms.insert(std::make_pair(file_name, sim_rom())).first;
+		if (!it->second.load(file_name)){
+			return false;
+		}
+	}
+	rom_ = &it->second;
+	if ((rom_->width_ != pins_.widths_[0]) || (rom_->addr_width_ != pins_.widths_[1])){
+		std::cerr << file_name << ": data and address widths do not match the pins" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// an input transition holds its values for the given number of cycles,
+// and the last one holds after the file runs out; as nothing else drives
+// the nets of an evl_input they are only set when a transition starts
+bool sim_input::read_next(size_t lane, sim_signals &signals){
+	sim_input_lane &input = lanes_[lane];
+	while (input.remaining_ == 0){
+		const char *field, *field_end;
+		int count;
+		if (!input.file_->next(field, field_end)){
+			return true;
+		}
+		bool ok = parse_decimal(field, field_end, count);
+		for (size_t i = 0; ok && (i < pins_.widths_.size()); ++i){
+			ok = input.file_->next(field, field_end)
+				&& parse_hex(field, field_end, pins_.widths_[i], &input.values_[words_begin_[i]]);
+		}
+		if (!ok){
+			std::cerr << "Invalid transition for input '" << pins_.name_ << "'" << std::endl;
+			return false;
+		}
+		input.remaining_ = count;
+		drive(signals, lane);
+	}
+	--input.remaining_;
+	return true;
+}
+
+// evl_input, evl_one, evl_zero and evl_clock are level-0 sources of the
+// levelized netlist together with evl_dff, whose state stays on its Q net
+void sim_input::drive(sim_signals &signals, size_t lane) const{
+	uint64_t bit = uint64_t(1) << (lane%64);
+	const uint64_t *values = &lanes_[lane].values_[0];
+	for (size_t i = 0; i < pins_.widths_.size(); ++i){
+		const int *nets = &pins_.nets_[pins_.nets_begin_[i]];
+		for (int j = 0; j < pins_.widths_[i]; ++j){
+			size_t w = nets[j]*signals.words_+lane/64;
+			if ((values[words_begin_[i]+j/64] >> (j%64)) & 1)
+				signals.value_[w] |= bit;
+			else
+				signals.value_[w] &= ~bit;
+			signals.unknown_[w] &= ~bit;
+		}
+	}
+}
+
+// the lanes are looked up 64 at a time: the address bits of each lane are
+// gathered from the address words, and each data word is assembled from the
+// ROM bits of the lanes; a lane whose address has an X or Z bit or is past
+// the end of the file reads X
+void sim_lut::compute(sim_signals &signals, size_t lanes) const{
+	const int *data_nets = &pins_.nets_[0], *addr_nets = &pins_.nets_[pins_.nets_begin_[1]];
+	size_t words = signals.words_;
+	uint64_t *v = &signals.value_[0], *u = &signals.unknown_[0];
+	for (size_t k = 0; k*64 < lanes; ++k){
+		size_t count = std::min(lanes-k*64, size_t(64));
+		size_t addrs[64];
+		uint64_t unknown = 0;
+		std::fill(addrs, addrs+count, size_t(0));
+		for (int i = 0; i < rom_->addr_width_; ++i){
+			uint64_t addr_v = v[addr_nets[i]*words+k];
+			unknown |= u[addr_nets[i]*words+k];
+			for (size_t lane = 0; lane < count; ++lane){
+				addrs[lane] |= size_t((addr_v >> lane) & 1) << i;
+			}
+		}
+		for (size_t lane = 0; lane < count; ++lane){
+			if (((unknown >> lane) & 1) || (addrs[lane] >= rom_->size_)){
+				unknown |= uint64_t(1) << lane;
+				addrs[lane] = 0;
+			}
+		}
+		for (int i = 0; i < rom_->width_; ++i){
+			uint64_t bits = 0;
+			for (size_t lane = 0; (lane < count) && (rom_->size_ != 0); ++lane){
+				bits |= uint64_t(rom_->bit(addrs[lane], i)) << lane;
+			}
+			v[data_nets[i]*words+k] = bits | unknown;
+			u[data_nets[i]*words+k] = unknown;
+		}
+	}
+}
+
+// the packed signals of every output net are appended to the trace each
+// cycle, and split into the per-lane files by write_trace
+void sim_output::record(const sim_signals &signals){
+	for (size_t i = 0; i < pins_.nets_.size(); ++i){
+		size_t begin = pins_.nets_[i]*signals.words_;
+		trace_.insert(trace_.end(), signals.value_.begin()+begin, signals.value_.begin()+begin+signals.words_);
+		trace_.insert(trace_.end(), signals.unknown_.begin()+begin, signals.unknown_.begin()+begin+signals.words_);
+	}
+}
+
+// a 1-bit pin is written as its signal, a bus as hex digits from the MSB
+// where a digit with any 'X' bit becomes 'X' and one with any 'Z' bit
+// becomes 'Z'
+void sim_output::write_trace(const std::vector<uint64_t> &trace, size_t words){
+	size_t frame_size = pins_.nets_.size()*2*words;
+	for (size_t lane = 0; lane < files_.size(); ++lane){
+		sim_writer &out = *files_[lane];
+		size_t word = lane/64;
+		int shift = int(lane%64);
+		for (size_t frame = 0; frame < trace.size(); frame += frame_size){
+			const uint64_t *entry = &trace[frame];
+			for (size_t i = 0; i < pins_.widths_.size(); ++i){
+				int width = pins_.widths_[i];
+				if (i != 0)
+					out.put(' ');
+				if (width == 1){
+					int v = int(entry[word] >> shift) & 1, u = int(entry[words+word] >> shift) & 1;
+					out.put("0Z1X"[v*2+u]);
+				}
+				for (int digit = (width+3)/4-1; (width > 1) && (digit >= 0); --digit){
+					int value = 0, unknown = 0;
+					for (int j = digit*4; (j < digit*4+4) && (j < width); ++j){
+						const uint64_t *bit = entry+j*2*words;
+						value |= int((bit[word] >> shift) & 1) << (j%4);
+						unknown |= int((bit[words+word] >> shift) & 1) << (j%4);
+					}
+					out.put((value & unknown)? 'X': unknown? 'Z': "0123456789ABCDEF"[value]);
+				}
+				entry += width*2*words;
+			}
+			out.put('\n');
+		}
+	}
+}
+
+sim_trace_block &sim_trace_ring::reserve(){
+	size_t tail = tail_.load(std::memory_order_relaxed);
+	while (tail-head_.load(std::memory_order_acquire) == blocks_.size()){
+		std::this_thread::yield();
+	}
+	return blocks_[tail%blocks_.size()];
+}
+
+// null while the ring is empty
+sim_trace_block *sim_trace_ring::front(){
+	size_t head = head_.load(std::memory_order_relaxed);
+	if (head == tail_.load(std::memory_order_acquire))
+		return 0;
+	return &blocks_[head%blocks_.size()];
+}
+
+// drops the drivers of a TRIS instruction that never win, and returns 'Z'
+// if none is left; constant holds '0', '1' or 'Z' for constant nets and 0
+// for the others
+char fold_drivers(sim_instruction &instr, std::vector<int> &operands, const std::vector<char> &constant){
+	int *op_begin = &operands[0]+instr.operands_begin, *op_end = &operands[0]+instr.operands_end, *kept = op_begin;
+	// a driver that is disabled or drives 'Z' never wins, one that is
+	// always enabled is a buf
+	for (int *op = op_begin; op != op_end; op += 2){
+		char enable = (op[0] == -1)? '1': constant[op[0]];
+		if ((enable == '0') || (enable == 'Z') || (constant[op[1]] == 'Z'))
+			continue;
+		*kept++ = (enable == '1')? -1: op[0];
+		*kept++ = op[1];
+	}
+	instr.operands_end = instr.operands_begin+(kept-op_begin);
+	return (kept == op_begin)? 'Z': 0;
+}
+
+// the combinational logic as EasyVL hashes it: a literal is twice a
+// variable plus one if inverted, variable 0 being the constant 0; a gate
+// is a chain of two-input nodes from its first input on, each simplified
+// against constants and its other input before it is looked up, so only
+// the gates that build the same nodes share a literal
+struct sim_strash{
+	std::vector <int> literals_;	// of each net, -1 until it is read or computed
+	std::vector <int> nets_;	// the net holding each literal, -1 for none
+	std::map<std::pair<int, int>, int> nodes_;	// literals of the AND nodes by inputs
+	sim_strash(size_t num_nets): literals_(num_nets, -1), nets_(2, -1) {}
+	int literal(int net, char c);
+	int node(gate_kind opcode, int a, int b);
+	int chain(sim_instruction &instr, std::vector<int> &operands, const std::vector<char> &constant);
+}; //Structure sim_strash
+
+// a net that is not computed by a gate, or is a 'Z' constant, is a
+// variable of its own
+int sim_strash::literal(int net, char c){
+	if (literals_[net] == -1){
+		if ((c == '0') || (c == '1'))
+			return c-'0';
+		literals_[net] = int(nets_.size());
+		nets_.push_back(net);
+		nets_.push_back(-1);
+	}
+	return literals_[net];
+}
+
+// an OR is the inverse of the AND of the inverted inputs and an XOR is
+// built from ANDs too, so only AND nodes are hashed and a complement is
+// found across the three kinds of gates
+int sim_strash::node(gate_kind opcode, int a, int b){
+	if (opcode == OR)
+		return node(AND, a^1, b^1)^1;
+	if (opcode == XOR)
+		return node(AND, node(AND, a, b^1)^1, node(AND, a^1, b)^1)^1;
+	if ((a == 0) || (b == 0) || (a == (b^1)))
+		return 0;
+	if ((a == 1) || (a == b))
+		return b;
+	if (b == 1)
+		return a;
+	std::pair<int, int> key(std::min(a, b), std::max(a, b));
+	std::map<std::pair<int, int>, int>::iterator it = nodes_.find(key);
+	if (it == nodes_.end()){
+		it = nodes_.insert(std::make_pair(key, int(nets_.size()))).first;
+		nets_.resize(nets_.size()+2, -1);
+	}
+	return it->second;
+}
+
+// returns the literal of an AND/OR/XOR/XNOR/NOT instruction and cuts its
+// operands down to those of the nodes left after simplification, in order,
+// so it still computes that literal including its 'X' outputs; with no
+// operand left it is a constant, with one a BUF or a NOT
+int sim_strash::chain(sim_instruction &instr, std::vector<int> &operands, const std::vector<char> &constant){
+	int *op_begin = &operands[0]+instr.operands_begin, *op_end = &operands[0]+instr.operands_end, *kept = op_begin;
+	gate_kind opcode = (instr.opcode == XNOR)? XOR: instr.opcode;
+	int acc = literal(*op_begin, constant[*op_begin]), inverted = 0;	// acc is the kept operands combined, then inverted
+	if (acc < 2)
+		inverted = acc;
+	else
+		*kept++ = *op_begin;
+	for (int *op = op_begin+1; (opcode != NOT) && (op != op_end); ++op){
+		int l = literal(*op, constant[*op]), r = node(opcode, acc, l);
+		if (r < 2){
+			kept = op_begin;
+			inverted = r;
+		}
+		else if ((r|1) == (acc|1)){
+			inverted ^= r^acc;	// combined with a constant
+		}
+		else if ((r|1) == (l|1)){
+			kept = op_begin;	// a constant combined with the operand
+			*kept++ = *op;
+			inverted = r^l;
+		}
+		else{
+			*kept++ = *op;
+		}
+		acc = r;
+	}
+	if ((instr.opcode == XNOR) || (instr.opcode == NOT)){
+		acc ^= 1;
+		inverted ^= 1;
+	}
+	instr.operands_end = instr.operands_begin+(kept-op_begin);
+	if (kept-op_begin == 1)
+		instr.opcode = inverted? NOT: BUF;
+	else if (opcode == XOR)
+		instr.opcode = inverted? XNOR: XOR;
+	return acc;
+}
+
+bool sim_program::create(const netlist &nl){
+	std::vector<sim_instruction> instructions;
+	std::vector<int> operands;
+	std::vector<int> producer(nl.num_sim_nets(), -1);	// instruction driving each net
+	std::vector<int> gates;	// number of netlist gates each instruction stands for
+
+	for (size_t g = 0; g < nl.num_gates(); ++g){
+		gate_kind kind = nl.gate_kinds_[g];
+		if ((kind > BUF) && (kind != EVL_LUT))
+			continue;
+		if (kind == BUF)
+			continue;	// merged into its input by alias_nets, or part of a bus resolved below
+		sim_instruction instr;
+		instr.opcode = kind;
+		instr.operands_begin = operands.size();
+		if (kind == EVL_LUT){
+			sim_lut lut;
+			lut.pins_.create(nl, int(g));
+			instr.output = int(luts_.size());
+			luts_.push_back(lut);
+			for (int i = 0; i < lut.pins_.widths_[0]; ++i){
+				producer[lut.pins_.nets_[i]] = int(instructions.size());
+			}
+			operands.insert(operands.end(), lut.pins_.nets_.begin()+lut.pins_.nets_begin_[1], lut.pins_.nets_.end());
+		}
+		else{
+			instr.output = nl.sim_net(nl.gate_pin(g, 0), 0);
+			producer[instr.output] = int(instructions.size());
+			for (int i = 1; i < nl.num_pins(g); ++i){
+				operands.push_back(nl.sim_net(nl.gate_pin(g, i), 0));
+			}
+		}
+		instr.operands_end = operands.size();
+		instructions.push_back(instr);
+		gates.push_back(1);
+	}
+
+	for (size_t n = 0; n < nl.num_nets(); ++n){
+		const int *drivers = &nl.net_drivers_[0] + nl.net_drivers_begin_[n], *drivers_end = &nl.net_drivers_[0] + nl.net_drivers_begin_[n+1];
+		if (drivers == drivers_end)
+			continue;
+		if ((drivers_end-drivers == 1) && (nl.gate_kinds_[nl.pin_gates_[*drivers]] != TRIS))
+			continue;
+		sim_instruction instr;
+		instr.opcode = TRIS;
+		instr.output = nl.net_sim_ids_[n];
+		instr.operands_begin = operands.size();
+		for (const int *d = drivers; d != drivers_end; ++d){
+			int g = nl.pin_gates_[*d];
+			operands.push_back((nl.gate_kinds_[g] == TRIS)? nl.sim_net(nl.gate_pin(g, 2), 0): -1);
+			operands.push_back(nl.sim_net(nl.gate_pin(g, 1), 0));
+		}
+		instr.operands_end = operands.size();
+		producer[instr.output] = int(instructions.size());
+		instructions.push_back(instr);
+		gates.push_back(int(drivers_end-drivers));
+	}
+
+	// Kahn's algorithm: an instruction is one level above its latest operand
+	std::vector<std::vector<int> > fanouts(nl.num_sim_nets());
+	// the constants are folded and the duplicates merged while the
+	// instructions are levelized, once all the operands of an instruction
+	// are known
+	std::vector<char> constant(nl.num_sim_nets(), 0);
+	for (size_t g = 0; g < nl.num_gates(); ++g){
+		if ((nl.gate_kinds_[g] == EVL_ONE) || (nl.gate_kinds_[g] == EVL_ZERO)){
+			for (int i = 0; i < nl.pin_width(nl.gate_pin(g, 0)); ++i){
+				constant[nl.sim_net(nl.gate_pin(g, 0), i)] = (nl.gate_kinds_[g] == EVL_ONE)? '1': '0';
+			}
+		}
+	}
+	constants_.clear();
+
+	// a gate with the literal of an earlier net, or of a buf, is replaced by
+	// that net in the operands of the instructions after it, and one with
+	// its inverse becomes a NOT of it; as they are visited in topological
+	// order, merging an instruction exposes the duplicates it creates
+	// further on; buses are kept apart as EasyVL does not merge them
+	equivalents_.resize(nl.num_sim_nets());
+	for (size_t n = 0; n < equivalents_.size(); ++n){
+		equivalents_[n] = int(n);
+	}
+	sim_strash strash(nl.num_sim_nets());
+	std::vector<int> pending(instructions.size(), 0), level(instructions.size(), 1);
+	std::vector<int> ready;
+	for (size_t i = 0; i < instructions.size(); ++i){
+		for (size_t j = instructions[i].operands_begin; j != instructions[i].operands_end; ++j){
+			if ((operands[j] != -1) && (producer[operands[j]] != -1)){
+				fanouts[operands[j]].push_back(int(i));
+				++pending[i];
+			}
+		}
+		if (pending[i] == 0)
+			ready.push_back(int(i));
+	}
+	for (size_t done = 0; done < ready.size(); ++done){
+		sim_instruction &instr = instructions[ready[done]];
+		for (size_t j = instr.operands_begin; j != instr.operands_end; ++j){
+			if (operands[j] != -1)
+				operands[j] = equivalents_[operands[j]];
+		}
+		if (instr.opcode == TRIS){
+			char c = fold_drivers(instr, operands, constant);
+			if (c != 0){
+				constant[instr.output] = c;
+				constants_.push_back(std::make_pair(instr.output, c));
+				level[ready[done]] = 0;	// does not hold back its fanouts
+			}
+		}
+		else if (instr.opcode != EVL_LUT){
+			int l = strash.chain(instr, operands, constant);
+			int *op_begin = &operands[0]+instr.operands_begin, *op_end = &operands[0]+instr.operands_end;
+			if (l < 2){
+				constant[instr.output] = char('0'+l);
+				constants_.push_back(std::make_pair(instr.output, char('0'+l)));
+				level[ready[done]] = 0;
+			}
+			else if (strash.nets_[l] != -1){
+				int rep = strash.nets_[l];
+				equivalents_[instr.output] = rep;
+				level[ready[done]] = (producer[rep] == -1)? 0: level[producer[rep]];
+			}
+			else{
+				if (strash.nets_[l^1] != -1){
+					*op_begin = strash.nets_[l^1];	// the inverse of an earlier net
+					op_end = op_begin+1;
+					instr.operands_end = instr.operands_begin+1;
+					instr.opcode = NOT;
+				}
+				strash.nets_[l] = instr.output;
+				int latest = 0;	// level of the latest operand left
+				for (int *op = op_begin; op != op_end; ++op){
+					latest = std::max(latest, (producer[*op] == -1)? 0: level[producer[*op]]);
+				}
+				level[ready[done]] = latest+1;
+			}
+			strash.literals_[instr.output] = l;
+		}
+		std::vector<int> outputs;
+		if (instr.opcode == EVL_LUT){
+			const sim_pins &pins = luts_[instr.output].pins_;
+			outputs.assign(pins.nets_.begin(), pins.nets_.begin()+pins.widths_[0]);
+		}
+		else{
+			outputs.push_back(instr.output);
+		}
+		for (size_t i = 0; i < outputs.size(); ++i){
+			const std::vector<int> &f = fanouts[outputs[i]];
+			for (size_t j = 0; j < f.size(); ++j){
+				level[f[j]] = std::max(level[f[j]], level[ready[done]]+1);
+				if (--pending[f[j]] == 0)
+					ready.push_back(f[j]);
+			}
+		}
+	}
+	if (ready.size() != instructions.size()){
+		for (size_t i = 0; i < instructions.size(); ++i){
+			if ((pending[i] != 0) && (instructions[i].opcode != EVL_LUT)){
+				std::cerr << "Net '" << nl.net_name(nl.sim_nets_[instructions[i].output]) << "' is in a combinational cycle" << std::endl;
+				return false;
+			}
+		}
+		std::cerr << "There is a combinational cycle through an evl_lut" << std::endl;
+		return false;
+	}
+
+	// only the instructions an evl_output or an evl_dff depends on are kept
+	std::vector<char> live(instructions.size(), 0);
+	std::vector<int> nets;
+	for (size_t g = 0; g < nl.num_gates(); ++g){
+		if (nl.gate_kinds_[g] == EVL_OUTPUT){
+			for (int p = nl.gate_pin(g, 0); p != nl.gate_pin(g, nl.num_pins(g)); ++p){
+				for (int i = 0; i < nl.pin_width(p); ++i){
+					nets.push_back(equivalents_[nl.sim_net(p, i)]);
+				}
+			}
+		}
+		else if (nl.gate_kinds_[g] == EVL_DFF){
+			nets.push_back(equivalents_[nl.sim_net(nl.gate_pin(g, 1), 0)]);
+		}
+	}
+	while (!nets.empty()){
+		int n = nets.back(), i = producer[n];
+		nets.pop_back();
+		if ((i == -1) || live[i] || (constant[n] != 0))
+			continue;
+		live[i] = 1;
+		for (size_t j = instructions[i].operands_begin; j != instructions[i].operands_end; ++j){
+			if (operands[j] != -1)
+				nets.push_back(operands[j]);
+		}
+	}
+	for (size_t i = 0; i < luts_.size(); ++i){
+		luts_[i].pins_.replace(equivalents_);
+	}
+	// a buf merged into its input by alias_nets is removed with its output,
+	// and so is every gate of an instruction that is not kept; a bus keeps
+	// only the drivers left by fold_drivers
+	removed_gates_ = 0;
+	for (size_t g = 0; g < nl.num_gates(); ++g){
+		if (nl.gate_kinds_[g] == BUF){
+			int out = nl.pin_net(nl.gate_pin(g, 0), 0);
+			if (nl.net_drivers_begin_[out+1]-nl.net_drivers_begin_[out] == 1)
+				++removed_gates_;
+		}
+	}
+	removed_nets_ = nl.num_nets()-nl.num_sim_nets();
+	for (size_t i = 0; i < instructions.size(); ++i){
+		if (!live[i])
+			removed_gates_ += gates[i];
+		else if (instructions[i].opcode == TRIS)
+			removed_gates_ += gates[i]-(instructions[i].operands_end-instructions[i].operands_begin)/2;
+	}
+	for (size_t n = 0; n < producer.size(); ++n){
+		if ((producer[n] != -1) && !live[producer[n]])
+			++removed_nets_;
+	}
+
+	// lay the instructions and their operands out in evaluation order, in
+	// runs of one level, opcode and operand count
+	std::vector<std::pair<std::pair<int, int>, std::pair<size_t, int> > > order;
+	for (size_t i = 0; i < instructions.size(); ++i){
+		if (!live[i])
+			continue;
+		order.push_back(std::make_pair(std::make_pair(level[i], int(instructions[i].opcode)),
+			std::make_pair(instructions[i].operands_end-instructions[i].operands_begin, int(i))));
+	}
+	std::sort(order.begin(), order.end());
+	instructions_.clear();
+	outputs_.clear();
+	operands_.clear();
+	levels_.clear();
+	runs_.clear();
+	for (size_t i = 0; i < order.size(); ++i){
+		if ((i == 0) || (order[i].first.first != order[i-1].first.first))
+			levels_.push_back(i);
+		if ((i == 0) || (order[i].first != order[i-1].first) || (order[i].second.first != order[i-1].second.first)){
+			sim_run run;
+			run.opcode = instructions[order[i].second.second].opcode;
+			run.arity = order[i].second.first;
+			run.first = i;
+			run.count = 0;
+			run.operands_begin = operands_.size();
+			runs_.push_back(run);
+		}
+		sim_run &run = runs_.back();
+		sim_instruction instr = instructions[order[i].second.second];
+		++run.count;
+		operands_.resize(operands_.size()+run.arity);
+		instructions_.push_back(instr);
+		outputs_.push_back(instr.output);
+	}
+	levels_.push_back(instructions_.size());
+	partition(std::max<size_t>(instructions_.size(), 1));
+	for (std::vector<sim_run>::const_iterator it = runs_.begin(); it != runs_.end(); ++it){
+		for (size_t i = 0; i < it->count; ++i){
+			sim_instruction &instr = instructions_[it->first+i];
+			for (size_t j = 0; j < it->arity; ++j){
+				size_t pos = (it->opcode <= BUF)? j*it->count+i: i*it->arity+j;
+				operands_[it->operands_begin+pos] = operands[instr.operands_begin+j];
+			}
+			instr.operands_begin = (it->opcode <= BUF)? 0: it->operands_begin+i*it->arity;
+			instr.operands_end = (it->opcode <= BUF)? 0: instr.operands_begin+it->arity;
+		}
+	}
+	return true;
+}
+
+// W is the number of 64-bit words per net
+// resolves count buses whose (enable, data) operand pairs follow each other,
+// arity operands per bus, where an enable of -1 means a buf driver: a single
+// driver not at 'Z' wins, several of them conflict, and none leave the bus
+// floating; the data of a driver is only read in the words where it is
+// enabled, so a bus with one driver on costs little more than its enables
+template <size_t W>
+void resolve_buses(uint64_t *v, uint64_t *u, const int *outputs, const int *operands, size_t count, size_t arity){
+	for (size_t i = 0; i < count; ++i, operands += arity){
+		uint64_t *out_v = v + outputs[i]*W, *out_u = u + outputs[i]*W;
+		for (size_t k = 0; k < W; ++k){
+			uint64_t one = 0, many = 0, val_v = 0, val_u = 0;
+			for (const int *op = operands; op != operands+arity; op += 2){
+				uint64_t enabled = (op[0] == -1)? ~uint64_t(0): v[op[0]*W+k] & ~u[op[0]*W+k];
+				if (enabled == 0)
+					continue;
+				uint64_t dv = v[op[1]*W+k], du = u[op[1]*W+k];
+				uint64_t driving = enabled & (dv | ~du);
+				many |= one & driving;
+				one |= driving;
+				val_v |= driving & dv;
+				val_u |= driving & du;
+			}
+			out_v[k] = many | (one & val_v);
+			out_u[k] = many | (one & val_u) | ~one;
+		}
+	}
+}
+
+// cuts each run into chunks of at most chunk_size instructions, the last
+// ones of a level being no smaller than the others
+void sim_program::partition(size_t chunk_size){
+	assert(chunk_size > 0);
+	chunk_size_ = chunk_size;
+	chunks_.clear();
+	level_chunks_.clear();
+	std::vector<sim_run>::const_iterator run = runs_.begin();
+	for (size_t l = 0; l+1 < levels_.size(); ++l){
+		level_chunks_.push_back(chunks_.size());
+		for (; (run != runs_.end()) && (run->first < levels_[l+1]); ++run){
+			size_t n = (run->count+chunk_size-1)/chunk_size;
+			for (size_t c = 0; c < n; ++c){
+				sim_chunk chunk;
+				chunk.run = run-runs_.begin();
+				chunk.begin = run->count*c/n;
+				chunk.end = run->count*(c+1)/n;
+				chunks_.push_back(chunk);
+			}
+		}
+	}
+	level_chunks_.push_back(chunks_.size());
+}
+
+template <size_t W>
+void sim_program::execute_chunk(sim_signals &signals, size_t lanes, const sim_chunk &chunk) const{
+	uint64_t *v = &signals.value_[0], *u = &signals.unknown_[0];
+	const sim_run *run = &runs_[chunk.run];
+	if (run->opcode <= BUF){
+		kernels_[run->opcode](v, u, &outputs_[run->first], &operands_[run->operands_begin], chunk.begin, chunk.end, run->count, run->arity);
+		return;
+	}
+	if (run->opcode == TRIS){
+		resolve_buses<W>(v, u, &outputs_[run->first+chunk.begin], &operands_[run->operands_begin+chunk.begin*run->arity], chunk.end-chunk.begin, run->arity);
+		return;
+	}
+	assert(run->opcode == EVL_LUT);
+	for (size_t i = run->first+chunk.begin; i != run->first+chunk.end; ++i){
+		luts_[instructions_[i].output].compute(signals, lanes);
+	}
+}
+
+// levels of a single chunk or fewer instructions than a chunk are not
+// worth waking the pool for
+bool sim_program::parallel_level(size_t l) const{
+	return (level_chunks_[l+1]-level_chunks_[l] > 1) && (levels_[l+1]-levels_[l] >= chunk_size_);
+}
+
+template <size_t W>
+void sim_program::execute(sim_signals &signals, size_t lanes, sim_pool *pool) const{
+	assert(signals.words_ == W);
+	for (size_t l = 0; l+1 < level_chunks_.size(); ++l){
+		size_t begin = level_chunks_[l], end = level_chunks_[l+1];
+		if ((pool != 0) && parallel_level(l)){
+			pool->run(begin, end);
+			continue;
+		}
+		for (size_t c = begin; c != end; ++c){
+			execute_chunk<W>(signals, lanes, chunks_[c]);
+		}
+	}
+}
+
+void sim_program::instruction_outputs(size_t i, std::vector<int> &nets) const{
+	nets.clear();
+	if (instructions_[i].opcode == EVL_LUT){
+		const sim_pins &pins = luts_[instructions_[i].output].pins_;
+		nets.assign(pins.nets_.begin(), pins.nets_.begin()+pins.widths_[0]);
+	}
+	else{
+		nets.push_back(outputs_[i]);
+	}
+}
+
+void sim_program::instruction_operands(size_t i, std::vector<int> &nets) const{
+	nets.clear();
+	const sim_run &run = runs_[instruction_runs_[i]];
+	for (size_t j = 0; j < run.arity; ++j){
+		int n = (run.opcode <= BUF)? operands_[run.operands_begin+j*run.count+i-run.first]: operands_[instructions_[i].operands_begin+j];
+		if (n != -1)
+			nets.push_back(n);
+	}
+}
+
+// indexes the instructions by the nets they read for execute_events
+void sim_program::prepare_events(size_t num_nets, sim_events &events){
+	instruction_runs_.resize(instructions_.size());
+	instruction_levels_.resize(instructions_.size());
+	for (size_t r = 0; r < runs_.size(); ++r){
+		std::fill(instruction_runs_.begin()+runs_[r].first, instruction_runs_.begin()+runs_[r].first+runs_[r].count, r);
+	}
+	for (size_t l = 0; l+1 < levels_.size(); ++l){
+		std::fill(instruction_levels_.begin()+levels_[l], instruction_levels_.begin()+levels_[l+1], l);
+	}
+	std::vector<char> computed(num_nets, 0);
+	std::vector<int> nets;
+	fanouts_begin_.assign(num_nets+1, 0);
+	sources_.clear();
+	for (size_t i = 0; i < instructions_.size(); ++i){
+		instruction_outputs(i, nets);
+		for (size_t k = 0; k < nets.size(); ++k){
+			computed[nets[k]] = 1;
+		}
+		instruction_operands(i, nets);
+		std::sort(nets.begin(), nets.end());
+		nets.erase(std::unique(nets.begin(), nets.end()), nets.end());
+		for (size_t k = 0; k < nets.size(); ++k){
+			++fanouts_begin_[nets[k]+1];
+		}
+	}
+	for (size_t n = 0; n < num_nets; ++n){
+		if ((fanouts_begin_[n+1] != 0) && !computed[n])
+			sources_.push_back(int(n));
+		fanouts_begin_[n+1] += fanouts_begin_[n];
+	}
+	fanouts_.resize(fanouts_begin_[num_nets]);
+	std::vector<size_t> next(fanouts_begin_.begin(), fanouts_begin_.end()-1);
+	for (size_t i = 0; i < instructions_.size(); ++i){
+		instruction_operands(i, nets);
+		std::sort(nets.begin(), nets.end());
+		nets.erase(std::unique(nets.begin(), nets.end()), nets.end());
+		for (size_t k = 0; k < nets.size(); ++k){
+			fanouts_[next[nets[k]]++] = int(i);
+		}
+	}
+	events.dirty.assign(instructions_.size(), 0);
+	events.buckets.assign(levels_.size()-1, std::vector<int>());
+	events.primed = false;
+}
+
+// evaluates the instructions reached by a change since the last call, the
+// first call evaluating them all, and returns how many were evaluated; an
+// instruction only queues its fanouts when one of its outputs changed, and
+// as the fanouts are at higher levels, one pass over the buckets suffices
+template <size_t W>
+size_t sim_program::execute_events(sim_signals &signals, size_t lanes, sim_events &events) const{
+	assert(signals.words_ == W);
+	const uint64_t *v = &signals.value_[0], *u = &signals.unknown_[0];
+	if (!events.primed){
+		execute<W>(signals, lanes, 0);
+		events.sources.resize(sources_.size()*2*W);
+		for (size_t s = 0; s < sources_.size(); ++s){
+			std::copy(v+sources_[s]*W, v+sources_[s]*W+W, events.sources.begin()+s*2*W);
+			std::copy(u+sources_[s]*W, u+sources_[s]*W+W, events.sources.begin()+s*2*W+W);
+		}
+		events.primed = true;
+		return instructions_.size();
+	}
+	std::vector<int> changed;
+	for (size_t s = 0; s < sources_.size(); ++s){
+		uint64_t *last = &events.sources[s*2*W];
+		if (std::equal(v+sources_[s]*W, v+sources_[s]*W+W, last) && std::equal(u+sources_[s]*W, u+sources_[s]*W+W, last+W))
+			continue;
+		std::copy(v+sources_[s]*W, v+sources_[s]*W+W, last);
+		std::copy(u+sources_[s]*W, u+sources_[s]*W+W, last+W);
+		changed.push_back(sources_[s]);
+	}
+	size_t evaluated = 0;
+	std::vector<int> outputs;
+	for (size_t l = 0;; ++l){
+		for (size_t k = 0; k < changed.size(); ++k){
+			for (size_t f = fanouts_begin_[changed[k]]; f != fanouts_begin_[changed[k]+1]; ++f){
+				int i = fanouts_[f];
+				if (events.dirty[i])
+					continue;
+				assert((l == 0) || (instruction_levels_[i] >= l));
+				events.dirty[i] = 1;
+				events.buckets[instruction_levels_[i]].push_back(i);
+			}
+		}
+		changed.clear();
+		while ((l < events.buckets.size()) && events.buckets[l].empty()){
+			++l;
+		}
+		if (l == events.buckets.size())
+			break;
+		std::vector<int> &bucket = events.buckets[l];
+		for (size_t k = 0; k < bucket.size(); ++k){
+			size_t i = bucket[k];
+			events.dirty[i] = 0;
+			instruction_outputs(i, outputs);
+			events.old.resize(outputs.size()*2*W);
+			for (size_t o = 0; o < outputs.size(); ++o){
+				std::copy(v+outputs[o]*W, v+outputs[o]*W+W, events.old.begin()+o*2*W);
+				std::copy(u+outputs[o]*W, u+outputs[o]*W+W, events.old.begin()+o*2*W+W);
+			}
+			sim_chunk chunk;
+			chunk.run = instruction_runs_[i];
+			chunk.begin = i-runs_[chunk.run].first;
+			chunk.end = chunk.begin+1;
+			execute_chunk<W>(signals, lanes, chunk);
+			for (size_t o = 0; o < outputs.size(); ++o){
+				const uint64_t *old = &events.old[o*2*W];
+				if (!std::equal(v+outputs[o]*W, v+outputs[o]*W+W, old) || !std::equal(u+outputs[o]*W, u+outputs[o]*W+W, old+W))
+					changed.push_back(outputs[o]);
+			}
+		}
+		evaluated += bucket.size();
+		bucket.clear();
+	}
+	return evaluated;
+}
+
+sim_pool::sim_pool(size_t workers, const std::function<void(size_t)> &task)
+	: task_(task), end_(0), next_(0), done_(0), generation_(0), stop_(false){
+	for (size_t i = 0; i < workers; ++i){
+		workers_.push_back(std::thread(&sim_pool::worker, this));
 	}
-	return true;
 }
 
-void net::append_pin(pin *p) {
-	connections_.push_back(p);
+sim_pool::~sim_pool(){
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+	started_.notify_all();
+	for (size_t i = 0; i < workers_.size(); ++i){
+		workers_[i].join();
+	}
 }
 
-bool pin::create(gate *g, size_t pin_index, const evl_pin &p, const std::map<std::string, net *> &nets_table, const evl_wires_table &wires_table){
-	pin_index_ = pin_index;
-	gate_ = g;
-  	P_msb = p.bus_msb;
- 	P_lsb = p.bus_lsb;
-    	net_name = p.name;
+void sim_pool::run(size_t begin, size_t end){
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		end_ = end;
+		next_.store(begin, std::memory_order_relaxed);
+		done_ = 0;
+		++generation_;
+	}
+	started_.notify_all();
+	work();
+	std::unique_lock<std::mutex> lock(mutex_);
+	finished_.wait(lock, [this]() {return done_ == workers_.size();});
+}
 
-    	evl_wires_table::const_iterator itrwire = wires_table.find(net_name);
+void sim_pool::work(){
+	for (size_t c; (c = next_.fetch_add(1, std::memory_order_relaxed)) < end_;){
+		task_(c);
+	}
+}
 
-	if ((p.bus_msb == -1) && (p.bus_lsb == -1)){ // 1-bit wire in or bus in
-		if(itrwire->second == 1){   // a 1-bit wire
-			length = itrwire->second;
-			net *netptr = new net;
-			std::map<std::string, net *>::const_iterator nnameitr = nets_table.find(net_name);
-			netptr = nnameitr->second;
-			nets_.push_back(netptr);
-			netptr->append_pin(this);
+void sim_pool::worker(){
+	for (size_t seen = 0;;){
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			started_.wait(lock, [&]() {return stop_ || (generation_ != seen);});
+			if (stop_)
+				return;
+			seen = generation_;
 		}
-    		else{
-			length = itrwire->second;
-			for(int i=0; i!=itrwire->second; ++i){
-			    net *netptr = new net;
-			    (*netptr).n_name = make_net_name(net_name, i);
-			    std::map<std::string, net *>::const_iterator nnameitr = nets_table.find((*netptr).n_name);
-			    netptr = nnameitr->second;
-			    nets_.push_back(netptr);
-			    netptr->append_pin(this);
-			}
+		work();
+		bool last;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			last = (++done_ == workers_.size());
 		}
+		if (last)
+			finished_.notify_one();
 	}
-	else if ((p.bus_lsb != -1)&&(p.bus_msb != -1)){
-		length = P_msb - P_lsb + 1;
-		for(int i=P_lsb; i<=P_msb; ++i){
-		    net *netptr = new net;
-		    (*netptr).n_name = make_net_name(net_name, i);
-		    std::map<std::string, net *>::const_iterator nnameitr = nets_table.find((*netptr).n_name);
-		    netptr = nnameitr->second;
-		    nets_.push_back(netptr);
-		    netptr->append_pin(this);
+}
+
+sim_compiled::~sim_compiled(){
+	close();
+}
+
+void sim_compiled::close(){
+#ifdef EVL_COMPILED
+	if (handle_ != 0)
+		dlclose(handle_);
+#endif
+	handle_ = 0;
+	execute_ = 0;
+}
+
+// the words of net n are v[n*words...] and u[n*words...], and the LUTs are
+// left to the simulator through lut
+void sim_compiled::generate(const sim_program &program, size_t words, std::string &source){
+	std::ostringstream out;
+	out << "// generated by net, do not edit\n"
+		"#include <stdint.h>\n"
+		"typedef uint64_t w_t;\n"
+		"#define AND_IN(n) a &= v[n]; b |= u[n];\n"
+		"#define OR_IN(n) a |= v[n]; b |= u[n];\n"
+		"#define XOR_IN(n) a ^= v[n]; b |= u[n];\n"
+		"#define AND_OUT(n) u[n] = b; v[n] = a | b;\n"
+		"#define OR_OUT(n) AND_OUT(n)\n"
+		"#define XOR_OUT(n) AND_OUT(n)\n"
+		"#define XNOR_OUT(n) u[n] = b; v[n] = ~a | b;\n"
+		"#define BUS_IN(e, d) f = v[e] & ~u[e] & (v[d] | ~u[d]); many |= one & f; one |= f; a |= f & v[d]; b |= f & u[d];\n"
+		"#define BUF_IN(d) f = v[d] | ~u[d]; many |= one & f; one |= f; a |= f & v[d]; b |= f & u[d];\n"
+		"#define BUS_OUT(n) v[n] = many | (one & a); u[n] = many | (one & b) | ~one;\n"
+		"extern \"C\" void evl_execute(w_t *v, w_t *u, void (*lut)(void *, int), void *context){\n";
+	for (std::vector<sim_run>::const_iterator run = program.runs_.begin(); run != program.runs_.end(); ++run){
+		for (size_t i = 0; i < run->count; ++i){
+			size_t o = size_t(program.outputs_[run->first+i]);
+			if (run->opcode == EVL_LUT){
+				out << "\tlut(context, " << run->first+i << ");\n";
+				continue;
+			}
+			for (size_t k = 0; k < words; ++k){
+				if (run->opcode == TRIS){
+					out << "\t{w_t one = 0, many = 0, a = 0, b = 0, f;";
+					for (size_t j = 0; j < run->arity; j += 2){
+						const int *op = &program.operands_[run->operands_begin+i*run->arity+j];
+						if (op[0] == -1)
+							out << " BUF_IN(" << op[1]*words+k << ")";
+						else
+							out << " BUS_IN(" << op[0]*words+k << ", " << op[1]*words+k << ")";
+					}
+					out << " BUS_OUT(" << o*words+k << ")}\n";
+					continue;
+				}
+				size_t in = size_t(program.operands_[run->operands_begin+i])*words+k;
+				if (run->opcode == NOT){
+					out << "\tv[" << o*words+k << "] = ~(v[" << in << "] ^ u[" << in << "]); u[" << o*words+k << "] = u[" << in << "];\n";
+					continue;
+				}
+				if (run->opcode == BUF){
+					out << "\tv[" << o*words+k << "] = v[" << in << "]; u[" << o*words+k << "] = u[" << in << "];\n";
+					continue;
+				}
+				const char *name = (run->opcode == AND)? "AND": (run->opcode == OR)? "OR": "XOR";
+				out << "\t{w_t a = " << ((run->opcode == AND)? "~w_t(0)": "0") << ", b = 0;";
+				for (size_t j = 0; j < run->arity; ++j){
+					out << " " << name << "_IN(" << size_t(program.operands_[run->operands_begin+j*run->count+i])*words+k << ")";
+				}
+				out << " " << ((run->opcode == XNOR)? "XNOR": name) << "_OUT(" << o*words+k << ")}\n";
+			}
 		}
 	}
+	out << "}\n";
+	source = out.str();
+}
+
+bool sim_compiled::open(const std::string &file_name, uint64_t source_hash){
+#ifdef EVL_COMPILED
+	std::string path = (file_name.find('/') == std::string::npos)? "./"+file_name: file_name;
+	handle_ = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+	if (handle_ == 0)
+		return false;
+	const uint64_t *hash = (const uint64_t *)dlsym(handle_, "evl_source_hash");
+	execute_ = (function)dlsym(handle_, "evl_execute");
+	if ((hash != 0) && (*hash == source_hash) && (execute_ != 0))
+		return true;
+#endif
+	close();
+	return false;
+}
 
-	else if ((p.bus_msb != -1) && (p.bus_lsb == -1)){
-		length = 1;
-		net *netptr = new net;
-		(*netptr).n_name = make_net_name(net_name, p.bus_msb);
-		std::map<std::string, net *>::const_iterator nnameitr = nets_table.find((*netptr).n_name);
-		netptr = nnameitr->second;
-		nets_.push_back(netptr);
-		netptr->append_pin(this);
+// the compiler is $CXX, c++ by default, whose words are passed as they are
+// without a shell in between
+bool sim_compiled::compile(const std::string &cpp_file, const std::string &so_file){
+#ifdef EVL_COMPILED
+	const char *cxx = getenv("CXX");
+	std::istringstream words((cxx != 0) && (*cxx != '\0')? cxx: "c++");
+	std::vector<std::string> args;
+	for (std::string word; words >> word; ){
+		args.push_back(word);
 	}
-	return true;
+	const char *flags[] = {"-O2", "-shared", "-fPIC", "-o"};
+	args.insert(args.end(), flags, flags+sizeof(flags)/sizeof(flags[0]));
+	args.push_back(so_file);
+	args.push_back(cpp_file);
+	std::vector<char *> argv;
+	for (size_t i = 0; i < args.size(); ++i){
+		argv.push_back(&args[i][0]);
+	}
+	argv.push_back(0);
+	pid_t pid = fork();
+	if (pid == 0){
+		execvp(argv[0], &argv[0]);
+		_exit(127);
+	}
+	int status;
+	while ((pid != -1) && (waitpid(pid, &status, 0) == -1)){
+		if (errno != EINTR)
+			return false;
+	}
+	if ((pid != -1) && WIFEXITED(status) && (WEXITSTATUS(status) == 0))
+		return true;
+	std::cerr << "Cannot compile " << cpp_file << " with '" << args[0] << "'" << std::endl;
+#endif
+	return false;
+}
+
+// the object is named after the hash of its source, which is checked
+// before it is loaded as its static constructors run on dlopen; the
+// source and the object are built under names of this process and the
+// object is renamed into place, so runs sharing an evl file never see each
+// other's partial files
+bool sim_compiled::load(const std::string &evl_file, const sim_program &program, size_t words){
+#ifdef EVL_COMPILED
+	std::string source;
+	generate(program, words, source);
+	uint64_t source_hash = evl_hash(source.data(), source.data()+source.size());
+	std::ostringstream name;
+	name << evl_file << ".sim." << std::hex << source_hash << ".so";
+	std::string so_file = name.str();
+	if (open(so_file, source_hash))
+		return true;
+	std::ostringstream suffix;
+	suffix << "." << getpid();
+	std::string cpp_file = evl_file+".sim"+suffix.str()+".cpp", temp_file = so_file+suffix.str()+".tmp";
+	std::ofstream out(cpp_file.c_str());
+	out << source << "extern \"C\" const uint64_t evl_source_hash = " << source_hash << "ull;\n";
+	out.close();
+	if (!out){
+		std::remove(cpp_file.c_str());
+		std::cerr << "Cannot write into file: " << cpp_file << "." << std::endl;
+		return false;
+	}
+	bool compiled = compile(cpp_file, temp_file);
+	std::remove(cpp_file.c_str());
+	if (!compiled){
+		std::remove(temp_file.c_str());
+		return false;
+	}
+	if (rename(temp_file.c_str(), so_file.c_str()) != 0){
+		std::remove(temp_file.c_str());
+		std::cerr << "Cannot write into file: " << so_file << "." << std::endl;
+		return false;
+	}
+	if (open(so_file, source_hash))
+		return true;
+	std::cerr << "Cannot load " << so_file << std::endl;
+#else
+	std::cerr << "The compiled engine is not available on this platform" << std::endl;
+#endif
+	return false;
 }
 
-bool gate::create_pin(const evl_pin &ep, size_t pin_index, const std::map<std::string, net *> &nets_table, const evl_wires_table &wires_table){
+struct sim_lut_context{
+	const sim_program *program;
+	sim_signals *signals;
+	size_t lanes;
+}; //Structure sim_lut_context
 
-	pin *p = new pin;
-	pins_.push_back(p);
-	return p->create(this, pin_index, ep, nets_table, wires_table);
+static void compute_lut(void *context, int i){
+	sim_lut_context *c = (sim_lut_context *)context;
+	c->program->luts_[c->program->instructions_[i].output].compute(*c->signals, c->lanes);
 }
 
-bool gate::create(const evl_component &component, const std::map <std::string, net *> &nets_table, const evl_wires_table &wires_table){
-	gate_type = component.type;
-	gate_name = component.name;
-	size_t pin_index = 0;
-	for (evl_pins::const_iterator it = component.pins.begin(); it != component.pins.end(); ++it){
-		create_pin(*it, pin_index, nets_table, wires_table);
-		++pin_index;
+void sim_compiled::execute(const sim_program &program, sim_signals &signals, size_t lanes) const{
+	sim_lut_context context = {&program, &signals, lanes};
+	execute_(&signals.value_[0], &signals.unknown_[0], compute_lut, &context);
+}
+
+//gate kernels start
+// a kernel evaluates gates [begin, end) of a run of count AND/OR/XOR/XNOR/NOT/BUF
+// instructions where operand j of gate i is operands[j*count+i]; the
+// accumulators are the values of the inputs combined by the gate and
+// whether any input is unknown; as in EasyVL, an AND/OR/XOR/XNOR with an
+// input at 'X' or 'Z' outputs 'X' whatever its other inputs, while NOT/BUF
+// keep a 'Z'
+template <int OP, size_t W>
+void scalar_gates(uint64_t *v, uint64_t *u, const int *outputs, const int *operands, size_t begin, size_t end, size_t count, size_t arity){
+	for (size_t i = begin; i < end; ++i){
+		uint64_t *out_v = v + outputs[i]*W, *out_u = u + outputs[i]*W;
+		for (size_t k = 0; k < W; ++k){
+			uint64_t a = (OP == AND)? ~uint64_t(0): 0, b = 0;
+			for (size_t j = 0; j < arity; ++j){
+				size_t op = size_t(operands[j*count+i])*W+k;
+				if (OP == AND)
+					a &= v[op];
+				else if (OP == OR)
+					a |= v[op];
+				else if ((OP == XOR) || (OP == XNOR))
+					a ^= v[op];
+				else
+					a = v[op];
+				b |= u[op];
+			}
+			out_u[k] = b;
+			if (OP == BUF)
+				out_v[k] = a;
+			else if (OP == NOT)
+				out_v[k] = ~(a ^ b);
+			else
+				out_v[k] = ((OP == XNOR)? ~a: a) | b;
+		}
 	}
- 	return true;
 }
 
-bool netlist::create_gate(const evl_component &component, const evl_wires_table &wires_table){
-	gate *g = new gate;
-	gates_.push_back(g);
-	return g->create(component, nets_table_, wires_table);
+#ifdef EVL_X86_KERNELS
+template <int OP>
+__attribute__((target("avx2"))) inline void avx2_step(__m256i iv, __m256i iu, __m256i &a, __m256i &b){
+	if (OP == AND)
+		a = _mm256_and_si256(a, iv);
+	else if (OP == OR)
+		a = _mm256_or_si256(a, iv);
+	else if ((OP == XOR) || (OP == XNOR))
+		a = _mm256_xor_si256(a, iv);
+	else
+		a = iv;
+	b = _mm256_or_si256(b, iu);
+}
+
+template <int OP>
+__attribute__((target("avx2"))) inline void avx2_finish(__m256i a, __m256i b, __m256i &ov, __m256i &ou){
+	const __m256i ones = _mm256_set1_epi64x(-1);
+	ou = b;
+	if (OP == BUF)
+		ov = a;
+	else if (OP == NOT)
+		ov = _mm256_xor_si256(_mm256_xor_si256(a, b), ones);
+	else if (OP == XNOR)
+		ov = _mm256_or_si256(_mm256_xor_si256(a, ones), b);
+	else
+		ov = _mm256_or_si256(a, b);
+}
+
+// 64 lanes: four gates per register, gathering their operands
+template <int OP>
+__attribute__((target("avx2"))) void avx2_gates_w1(uint64_t *v, uint64_t *u, const int *outputs, const int *operands, size_t begin, size_t end, size_t count, size_t arity){
+	const __m256i init_a = (OP == AND)? _mm256_set1_epi64x(-1): _mm256_setzero_si256();
+	size_t i = begin;
+	for (; i+4 <= end; i += 4){
+		__m256i a = init_a, b = _mm256_setzero_si256(), ov, ou;
+		for (size_t j = 0; j < arity; ++j){
+			__m128i index = _mm_loadu_si128((const __m128i *)(operands+j*count+i));
+			avx2_step<OP>(_mm256_i32gather_epi64((const long long *)v, index, 8),
+				_mm256_i32gather_epi64((const long long *)u, index, 8), a, b);
+		}
+		avx2_finish<OP>(a, b, ov, ou);
+		uint64_t tv[4], tu[4];
+		_mm256_storeu_si256((__m256i *)tv, ov);
+		_mm256_storeu_si256((__m256i *)tu, ou);
+		for (size_t g = 0; g < 4; ++g){
+			v[outputs[i+g]] = tv[g];
+			u[outputs[i+g]] = tu[g];
+		}
+	}
+	scalar_gates<OP, 1>(v, u, outputs, operands, i, end, count, arity);
+}
+
+// 256 lanes: one gate per register
+template <int OP>
+__attribute__((target("avx2"))) void avx2_gates_w4(uint64_t *v, uint64_t *u, const int *outputs, const int *operands, size_t begin, size_t end, size_t count, size_t arity){
+	const __m256i init_a = (OP == AND)? _mm256_set1_epi64x(-1): _mm256_setzero_si256();
+	for (size_t i = begin; i < end; ++i){
+		__m256i a = init_a, b = _mm256_setzero_si256(), ov, ou;
+		for (size_t j = 0; j < arity; ++j){
+			size_t op = size_t(operands[j*count+i])*4;
+			avx2_step<OP>(_mm256_loadu_si256((const __m256i *)(v+op)), _mm256_loadu_si256((const __m256i *)(u+op)), a, b);
+		}
+		avx2_finish<OP>(a, b, ov, ou);
+		_mm256_storeu_si256((__m256i *)(v+size_t(outputs[i])*4), ov);
+		_mm256_storeu_si256((__m256i *)(u+size_t(outputs[i])*4), ou);
+	}
 }
 
-bool netlist::create_gates(const evl_components &components, const evl_wires_table &wires_table){
-	for (evl_components::const_iterator itr = components.begin(); itr != components.end(); ++itr){
-		create_gate(*itr, wires_table);
+// 64 lanes: eight gates per register, gathering their operands and
+// scattering their outputs
+template <int OP>
+__attribute__((target("avx512f"))) void avx512_gates_w1(uint64_t *v, uint64_t *u, const int *outputs, const int *operands, size_t begin, size_t end, size_t count, size_t arity){
+	const __m512i ones = _mm512_set1_epi64(-1), zero = _mm512_setzero_si512();
+	const __m512i init_a = (OP == AND)? ones: _mm512_setzero_si512();
+	size_t i = begin;
+	for (; i+8 <= end; i += 8){
+		__m512i a = init_a, b = _mm512_setzero_si512(), ov, ou;
+		for (size_t j = 0; j < arity; ++j){
+			__m256i index = _mm256_loadu_si256((const __m256i *)(operands+j*count+i));
+			__m512i iv = _mm512_mask_i32gather_epi64(zero, 0xff, index, v, 8), iu = _mm512_mask_i32gather_epi64(zero, 0xff, index, u, 8);
+			if (OP == AND)
+				a = _mm512_and_si512(a, iv);
+			else if (OP == OR)
+				a = _mm512_or_si512(a, iv);
+			else if ((OP == XOR) || (OP == XNOR))
+				a = _mm512_xor_si512(a, iv);
+			else
+				a = iv;
+			b = _mm512_or_si512(b, iu);
+		}
+		ou = b;
+		if (OP == BUF)
+			ov = a;
+		else if (OP == NOT)
+			ov = _mm512_xor_si512(_mm512_xor_si512(a, b), ones);
+		else if (OP == XNOR)
+			ov = _mm512_or_si512(_mm512_xor_si512(a, ones), b);
+		else
+			ov = _mm512_or_si512(a, b);
+		__m256i index = _mm256_loadu_si256((const __m256i *)(outputs+i));
+		_mm512_i32scatter_epi64(v, index, ov, 8);
+		_mm512_i32scatter_epi64(u, index, ou, 8);
+	}
+	scalar_gates<OP, 1>(v, u, outputs, operands, i, end, count, arity);
+}
+#endif
+
+// isa is "auto" for the best one the CPU supports, or one of "avx512",
+// "avx2" and "scalar"; AVX-512 has no 256-lane kernels and uses AVX2 there
+bool sim_program::select_kernels(size_t words, const std::string &isa){
+	std::string chosen = isa;
+#ifdef EVL_X86_KERNELS
+	__builtin_cpu_init();
+	bool has_avx2 = __builtin_cpu_supports("avx2"), has_avx512 = has_avx2 && __builtin_cpu_supports("avx512f");
+#else
+	bool has_avx2 = false, has_avx512 = false;
+#endif
+	if (chosen == "auto")
+		chosen = has_avx512? "avx512": has_avx2? "avx2": "scalar";
+	if (((chosen == "avx512") && !has_avx512) || ((chosen == "avx2") && !has_avx2)
+		|| ((chosen != "avx512") && (chosen != "avx2") && (chosen != "scalar"))){
+		std::cerr << "Kernels '" << isa << "' are not available on this machine" << std::endl;
+		return false;
+	}
+	if (words == 1){
+		kernels_[AND] = scalar_gates<AND, 1>;
+		kernels_[OR] = scalar_gates<OR, 1>;
+		kernels_[XOR] = scalar_gates<XOR, 1>;
+		kernels_[XNOR] = scalar_gates<XNOR, 1>;
+		kernels_[NOT] = scalar_gates<NOT, 1>;
+		kernels_[BUF] = scalar_gates<BUF, 1>;
 	}
+	else{
+		kernels_[AND] = scalar_gates<AND, 4>;
+		kernels_[OR] = scalar_gates<OR, 4>;
+		kernels_[XOR] = scalar_gates<XOR, 4>;
+		kernels_[XNOR] = scalar_gates<XNOR, 4>;
+		kernels_[NOT] = scalar_gates<NOT, 4>;
+		kernels_[BUF] = scalar_gates<BUF, 4>;
+	}
+#ifdef EVL_X86_KERNELS
+	if ((chosen == "avx512") && (words == 1)){
+		kernels_[AND] = avx512_gates_w1<AND>;
+		kernels_[OR] = avx512_gates_w1<OR>;
+		kernels_[XOR] = avx512_gates_w1<XOR>;
+		kernels_[XNOR] = avx512_gates_w1<XNOR>;
+		kernels_[NOT] = avx512_gates_w1<NOT>;
+		kernels_[BUF] = avx512_gates_w1<BUF>;
+	}
+	else if ((chosen == "avx2") && (words == 1)){
+		kernels_[AND] = avx2_gates_w1<AND>;
+		kernels_[OR] = avx2_gates_w1<OR>;
+		kernels_[XOR] = avx2_gates_w1<XOR>;
+		kernels_[XNOR] = avx2_gates_w1<XNOR>;
+		kernels_[NOT] = avx2_gates_w1<NOT>;
+		kernels_[BUF] = avx2_gates_w1<BUF>;
+	}
+	else if (chosen != "scalar"){
+		kernels_[AND] = avx2_gates_w4<AND>;
+		kernels_[OR] = avx2_gates_w4<OR>;
+		kernels_[XOR] = avx2_gates_w4<XOR>;
+		kernels_[XNOR] = avx2_gates_w4<XNOR>;
+		kernels_[NOT] = avx2_gates_w4<NOT>;
+		kernels_[BUF] = avx2_gates_w4<BUF>;
+	}
+#endif
 	return true;
 }
+//gate kernels end
 
-bool netlist::create(const evl_wires &wires, const evl_components &components, const evl_wires_table &wires_table){
-	return create_nets(wires) && create_gates(components, wires_table);
+// the class of net n, halving the path to it
+int find_net_class(std::vector<int> &parent, int n){
+	while (parent[n] != n){
+		parent[n] = parent[parent[n]];
+		n = parent[n];
+	}
+	return n;
 }
 
-void netlist::display_netlist(std::ostream &out){
+// a buf that is the only driver of its output, including the bufs of assign
+// statements, copies its input unchanged, so the nets it joins are simulated
+// as one net; the classes of joined nets are numbered in net order and named
+// after the net at the start of the buf chain
+bool netlist::alias_nets(){
+	std::vector<int> parent(num_nets());
+	for (size_t n = 0; n < num_nets(); ++n){
+		parent[n] = int(n);
+	}
+	for (size_t g = 0; g < num_gates(); ++g){
+		if (gate_kinds_[g] != BUF)
+			continue;
+		int out = pin_net(gate_pin(g, 0), 0);
+		if (net_drivers_begin_[out+1]-net_drivers_begin_[out] != 1)
+			continue;	// part of a bus
+		int out_class = find_net_class(parent, out), in_class = find_net_class(parent, pin_net(gate_pin(g, 1), 0));
+		if (out_class == in_class){
+			std::cerr << "Net '" << net_name(out) << "' is in a combinational cycle" << std::endl;
+			return false;
+		}
+		parent[out_class] = in_class;
+	}
+	net_sim_ids_.assign(num_nets(), -1);
+	sim_nets_.clear();
+	for (size_t n = 0; n < num_nets(); ++n){
+		int c = find_net_class(parent, int(n));
+		if (net_sim_ids_[c] == -1){
+			net_sim_ids_[c] = int(sim_nets_.size());
+			sim_nets_.push_back(c);
+		}
+		net_sim_ids_[n] = net_sim_ids_[c];
+	}
+	return true;
+}
+
+bool netlist::prepare_simulation(const std::string &evl_file, size_t lanes, const std::string &kernels){
+	net_drivers_begin_.assign(num_nets()+1, 0);
+	for (size_t g = 0; g < num_gates(); ++g){
+		if (!validate_structural_semantics(int(g))){
+			return false;
+		}
+	}
+	for (size_t p = 0; p < pin_gates_.size(); ++p){
+		for (int i = 0; (pin_dirs_[p] == 'O') && (i < pin_width(int(p))); ++i){
+			++net_drivers_begin_[pin_net(int(p), i)+1];
+		}
+	}
+	for (size_t n = 0; n < num_nets(); ++n){
+		net_drivers_begin_[n+1] += net_drivers_begin_[n];
+	}
+	std::vector<int> next(net_drivers_begin_.begin(), net_drivers_begin_.end()-1);
+	net_drivers_.resize(net_drivers_begin_.back()+1);	// never empty so &net_drivers_[0] is valid
+	for (size_t p = 0; p < pin_gates_.size(); ++p){
+		for (int i = 0; (pin_dirs_[p] == 'O') && (i < pin_width(int(p))); ++i){
+			net_drivers_[next[pin_net(int(p), i)]++] = int(p);
+		}
+	}
+
+	// as in EasyVL, a net may have several drivers only if they are all tris
+	// gates or bufs whose inputs are, through buf chains, driven by tris gates
+	std::vector<char> tris_nets(num_nets(), 0);
+	std::vector<int> tris_queue;
+	for (size_t g = 0; g < num_gates(); ++g){
+		int out = pin_net(gate_pin(int(g), 0), 0);
+		if ((gate_kinds_[g] == TRIS) && !tris_nets[out]){
+			tris_nets[out] = 1;
+			tris_queue.push_back(out);
+		}
+	}
+	while (!tris_queue.empty()){
+		int n = tris_queue.back();
+		tris_queue.pop_back();
+		for (int i = net_pins_begin_[n]; i != net_pins_begin_[n+1]; ++i){
+			int p = net_pins_[i], g = pin_gates_[p];
+			if ((gate_kinds_[g] != BUF) || (pin_index(p) != 1))
+				continue;
+			int out = pin_net(gate_pin(g, 0), 0);
+			if (!tris_nets[out]){
+				tris_nets[out] = 1;
+				tris_queue.push_back(out);
+			}
+		}
+	}
 
-	out << "nets " << nets_.size() << std::endl;
-	for (std::list<net *>::const_iterator itnets = nets_.begin(); itnets != nets_.end(); ++itnets){
-		out << "  net " << (*itnets)->n_name << " " << (*itnets)->connections_.size() << std::endl;
-		for (std::list<pin *>::const_iterator itpins = (*itnets)->connections_.begin(); itpins != (*itnets)->connections_.end(); ++itpins){
-			if ((*itpins)->gate_->gate_name == ""){
-				out << "    " << (*itpins)->gate_->gate_type << " " << (*itpins)->pin_index_ << std::endl;
+	for (size_t n = 0; n < num_nets(); ++n){
+		if (net_pins_begin_[n] == net_pins_begin_[n+1])
+			continue;
+		int first = net_drivers_begin_[n], last = net_drivers_begin_[n+1];
+		if (first == last){
+			std::cerr << "Net '" << net_name(n) << "' has no driver" << std::endl;
+			return false;
+		}
+		if (last-first > 1){
+			int tris = 0;
+			for (int i = first; i != last; ++i){
+				int g = pin_gates_[net_drivers_[i]];
+				if ((gate_kinds_[g] == TRIS) || ((gate_kinds_[g] == BUF) && tris_nets[pin_net(gate_pin(g, 1), 0)]))
+					++tris;
 			}
-			else{
-				out << "    " << (*itpins)->gate_->gate_type << " " << (*itpins)->gate_->gate_name << " " << (*itpins)->pin_index_ << std::endl;
+			if (tris == 0){
+				std::cerr << "Net '" << net_name(n) << "' has multiple drivers" << std::endl;
+				return false;
+			}
+			if (tris != last-first){
+				std::cerr << "Net '" << net_name(n) << "' has mixed gate and tris drivers" << std::endl;
+				return false;
+			}
+		}
+		if (gate_kinds_[pin_gates_[net_drivers_[first]]] == EVL_CLOCK){
+			for (int i = net_pins_begin_[n]; i != net_pins_begin_[n+1]; ++i){
+				int p = net_pins_[i];
+				if ((pin_dirs_[p] == 'I') && ((gate_kinds_[pin_gates_[p]] != EVL_DFF) || (pin_index(p) != 2))){
+					std::cerr << "Clock '" << net_name(n) << "' cannot drive combinational logic" << std::endl;
+					return false;
+				}
+			}
+		}
+	}
+
+	if (!alias_nets() || !program_.create(*this) || !program_.select_kernels((lanes <= 64)? 1: 4, kernels)){
+		return false;
+	}
+	for (size_t i = 0; i < program_.luts_.size(); ++i){
+		if (!program_.luts_[i].load(evl_file, program_.roms_)){
+			return false;
+		}
+	}
+
+	signals_.resize(num_sim_nets(), (lanes <= 64)? 1: 4);	// see simulate
+	for (size_t g = 0; g < num_gates(); ++g){
+		gate_kind kind = gate_kinds_[g];
+		if (kind == EVL_DFF){
+			dff_q_.push_back(sim_net(gate_pin(g, 0), 0));	// starts at 0
+			dff_d_.push_back(program_.equivalents_[sim_net(gate_pin(g, 1), 0)]);
+		}
+		else if (kind == EVL_INPUT){
+			inputs_.push_back(sim_input());
+			inputs_.back().pins_.create(*this, int(g));
+			if (!inputs_.back().open(evl_file, lanes))
+				return false;
+		}
+		else if (kind == EVL_OUTPUT){
+			outputs_.push_back(sim_output());
+			outputs_.back().pins_.create(*this, int(g));
+			outputs_.back().pins_.replace(program_.equivalents_);
+			if (!outputs_.back().open(evl_file, lanes))
+				return false;
+		}
+		else if ((kind == EVL_ONE) || (kind == EVL_ZERO) || (kind == EVL_CLOCK)){
+			// constant for the whole simulation
+			for (int p = gate_pins_begin_[g]; p != gate_pins_begin_[g+1]; ++p){
+				for (int i = 0; i < pin_width(p); ++i){
+					signals_.fill(sim_net(p, i), (kind == EVL_ONE)? '1': '0');
+				}
 			}
 		}
 	}
+	for (size_t i = 0; i < program_.constants_.size(); ++i){
+		signals_.fill(program_.constants_[i].first, program_.constants_[i].second);
+	}
+	std::cout << "Removed " << program_.removed_gates_ << " gates and " << program_.removed_nets_
+		<< " nets that are constant, duplicate or not observable" << std::endl;
+	return true;
+}
 
-	out << "components " << gates_.size() << std::endl;
-	for (std::list<gate *>::const_iterator itgts = gates_.begin(); itgts != gates_.end(); ++itgts){
-		if ((*itgts)->gate_name == ""){
-		    out << "  component " << (*itgts)->gate_type << " " << (*itgts)->pins_.size() << std::endl;
+// the traces of the outputs go to the writer thread through ring, or are
+// written here without one
+void netlist::write_traces(sim_trace_ring *ring, size_t words){
+	for (size_t i = 0; i < outputs_.size(); ++i){
+		if (ring != 0){
+			sim_trace_block &block = ring->reserve();
+			block.output = i;
+			block.trace.swap(outputs_[i].trace_);
+			ring->push();
 		}
 		else{
-		    out << "  component " << (*itgts)->gate_type << " " << (*itgts)->gate_name << " " << (*itgts)->pins_.size() << std::endl;
+			outputs_[i].write_trace(outputs_[i].trace_, words);
 		}
-		for (std::vector<pin *>::const_iterator itrpins = (*itgts)->pins_.begin(); itrpins != (*itgts)->pins_.end(); ++itrpins){
-			//out << "    pin " << "1 " << (*itrpins)->netname << std::endl;
-            out << "    pin " << (*itrpins)->length;
-            for(std::vector <net *>::const_iterator itrnets = (*itrpins)->nets_.begin(); itrnets != (*itrpins)->nets_.end(); ++itrnets){
-                out << " " << (*itrnets)->n_name;
-            }
-            out << std::endl;
+		outputs_[i].trace_.clear();
+	}
+}
+
+// with more than one thread the output files are formatted and written by
+// a thread of their own while the simulation goes on, and the levels are
+// cut into chunks of about sim_chunk_words words of signals evaluated by
+// threads workers at a time, with the workers only started when a level is
+// large enough to be shared; with events, only the instructions whose
+// operands changed are evaluated, by a single thread, the cycle, number and
+// share of the instructions evaluated are written to "<evl_file>.activity"
+// a line per cycle, and their average over the run is reported
+template <size_t W>
+bool netlist::run_simulation(const std::string &evl_file, int cycles, size_t lanes, size_t threads,
+	const std::string &engine){
+	const int trace_cycles = 256;	// cycles of packed outputs passed on at a time
+	bool events = (engine == "event");
+	sim_compiled compiled;
+	if ((engine == "compiled") && !compiled.load(evl_file, program_, W))
+		return false;
+	sim_events queue;
+	double activity = 0, min_activity = 1, max_activity = 0;
+	sim_writer activity_file;	// instructions evaluated in each cycle
+	if (events){
+		program_.prepare_events(num_sim_nets(), queue);
+		if (!activity_file.open(evl_file+".activity")){
+			std::cerr << "I can't write into file " << evl_file << ".activity." << std::endl;
+			return false;
+		}
+	}
+	sim_pool *pool = 0;
+	if ((threads > 1) && (engine == "levelized")){
+		program_.partition(sim_chunk_words/W);
+		for (size_t l = 0; (pool == 0) && (l+1 < program_.levels_.size()); ++l){
+			if (program_.parallel_level(l)){
+				pool = new sim_pool(threads-1, [&](size_t c) {
+					program_.execute_chunk<W>(signals_, lanes, program_.chunks_[c]);
+				});
+			}
+		}
+	}
+	sim_trace_ring ring(4*outputs_.size());
+	std::thread writer;
+	if ((threads > 1) && !outputs_.empty()){
+		writer = std::thread([&]() {
+			for (;;){
+				sim_trace_block *block = ring.front();
+				if (block == 0){
+					std::this_thread::sleep_for(std::chrono::microseconds(100));
+					continue;
+				}
+				if (block->output == sim_trace_block::none_){
+					ring.pop();
+					return;
+				}
+				outputs_[block->output].write_trace(block->trace, W);
+				ring.pop();
+			}
+		});
+	}
+	bool ok = true;
+	next_state_.assign(dff_d_.size()*2*W, 0);
+	for (int cycle = 0; ok && (cycle < cycles); ++cycle){
+		for (size_t i = 0; ok && (i < inputs_.size()); ++i){
+			for (size_t lane = 0; ok && (lane < lanes); ++lane){
+				ok = inputs_[i].read_next(lane, signals_);
+			}
+		}
+		if (!ok)
+			break;
+		if (events){
+			size_t total = std::max<size_t>(program_.instructions_.size(), 1);
+			size_t evaluated = program_.execute_events<W>(signals_, lanes, queue);
+			double a = double(evaluated)/total;
+			std::ostringstream line;
+			line << cycle << ' ' << evaluated << ' ' << 100*a << "%\n";
+			activity_file.write(line.str());
+			activity += a;
+			min_activity = std::min(min_activity, a);
+			max_activity = std::max(max_activity, a);
+		}
+		else if (engine == "compiled"){
+			compiled.execute(program_, signals_, lanes);
+		}
+		else{
+			program_.execute<W>(signals_, lanes, pool);
+		}
+		for (size_t i = 0; i < outputs_.size(); ++i){
+			outputs_[i].record(signals_);
+		}
+		// latch every D before updating any Q since a Q may feed another D
+		for (size_t i = 0; i < dff_d_.size(); ++i){
+			size_t d = dff_d_[i]*W;
+			std::copy(signals_.value_.begin()+d, signals_.value_.begin()+d+W, next_state_.begin()+i*2*W);
+			std::copy(signals_.unknown_.begin()+d, signals_.unknown_.begin()+d+W, next_state_.begin()+i*2*W+W);
 		}
+		for (size_t i = 0; i < dff_q_.size(); ++i){
+			size_t q = dff_q_[i]*W;
+			std::copy(next_state_.begin()+i*2*W, next_state_.begin()+i*2*W+W, signals_.value_.begin()+q);
+			std::copy(next_state_.begin()+i*2*W+W, next_state_.begin()+(i+1)*2*W, signals_.unknown_.begin()+q);
+		}
+		if (((cycle+1)%trace_cycles == 0) || (cycle+1 == cycles)){
+			write_traces(writer.joinable()? &ring: 0, W);
+		}
+	}
+	if (writer.joinable()){
+		ring.reserve().output = sim_trace_block::none_;
+		ring.push();
+		writer.join();
+	}
+	delete pool;
+	activity_file.flush();
+	if (events && (cycles > 0)){
+		std::cout << "Activity factor " << 100*activity/cycles << "% of " << program_.instructions_.size()
+			<< " instructions per cycle, from " << 100*min_activity << "% to " << 100*max_activity << "%" << std::endl;
 	}
+	return ok;
 }
 
-//netlist end
+// lanes independent stimulus vectors are simulated together, 64 per
+// machine word, up to 256 with four words per net; kernels is the
+// instruction set of the gate kernels, see sim_program::select_kernels, and
+// threads above 1 let a writer thread produce the output files and the
+// levels be evaluated in parallel; engine is "levelized" to evaluate every
+// instruction each cycle, "event" to only evaluate those reached by a
+// change or "compiled" to run them as native code, see sim_compiled
+bool netlist::simulate(const std::string &evl_file, int cycles, size_t lanes, const std::string &kernels, size_t threads,
+	const std::string &engine){
+	assert((lanes >= 1) && (lanes <= 256));
+	if ((engine != "levelized") && (engine != "event") && (engine != "compiled")){
+		std::cerr << "Unknown simulation engine '" << engine << "'" << std::endl;
+		return false;
+	}
+	bool ok = prepare_simulation(evl_file, lanes, kernels);
+	if (ok){
+		if (lanes <= 64)
+			ok = run_simulation<1>(evl_file, cycles, lanes, threads, engine);
+		else
+			ok = run_simulation<4>(evl_file, cycles, lanes, threads, engine);
+	}
+	for (size_t i = 0; i < inputs_.size(); ++i){
+		inputs_[i].close();
+	}
+	for (size_t i = 0; i < outputs_.size(); ++i){
+		outputs_[i].close();
+	}
+	return ok;
+}
 
-int main(int argc, char *argv[])
+//simulation end
+
+// options are given after the file name as name=value, e.g. cycles=5000
+typedef std::map<std::string, std::string> evl_options;
+
+bool parse_options(int argc, char *argv[], evl_options &options){
+	const char *known[] = {"cycles", "lanes", "simd", "threads", "dump", "cache", "engine"};
+	for (int i = 2; i < argc; ++i){
+		std::string option = argv[i];
+		size_t eq = option.find('=');
+		std::string name = option.substr(0, eq);
+		if ((eq == std::string::npos) || (std::find(known, known+sizeof(known)/sizeof(known[0]), name) == known+sizeof(known)/sizeof(known[0]))){
+			std::cerr << "Unknown option '" << option << "'" << std::endl;
+			return false;
+		}
+		options[name] = option.substr(eq+1);
+	}
+	return true;
+}
+
+bool get_int_option(const evl_options &options, const std::string &name, int min, int max, int &value){
+	evl_options::const_iterator it = options.find(name);
+	if (it == options.end())
+		return true;	// keep the default
+	char *end;
+	long v = strtol(it->second.c_str(), &end, 10);
+	if (it->second.empty() || (*end != '\0') || (v < min) || (v > max)){
+		std::cerr << "Option '" << name << "' must be between " << min << " and " << max << std::endl;
+		return false;
+	}
+	value = int(v);
+	return true;
+}
+
+// a comma separated list of names out of known, "all" for all of them
+bool get_list_option(const evl_options &options, const std::string &name,
+	const char *const *known, size_t num_known, std::set<std::string> &values){
+	evl_options::const_iterator it = options.find(name);
+	if (it == options.end())
+		return true;
+	std::istringstream list(it->second);
+	for (std::string value; std::getline(list, value, ',');){
+		if (value == "all"){
+			values.insert(known, known+num_known);
+		}
+		else if (std::find(known, known+num_known, value) != known+num_known){
+			values.insert(value);
+		}
+		else{
+			std::cerr << "Option '" << name << "' does not take '" << value << "'" << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+
+// the source is lexed, grouped and processed one statement at a time, in
+// chunks of whole statements for large files; the tokens of a fresh binary
+// .tokens file from lex format=binary are read back instead of lexing the
+// source, and the file is kept
+bool build_netlist(const std::string &evl_file, const evl_source &source, uint64_t source_hash, size_t threads,
+	const std::set<std::string> &dump, evl_modules &modules, netlist &nl)
 {
-	if (argc < 2)   // Input File 
+	evl_chunks chunks;
+	evl_token_decoder decoder;
+	bool binary_tokens = decoder.open(evl_file+".tokens", source_hash);
+	bool keep_statements = dump.count("statements") != 0;
+	if (binary_tokens && !parse_tokens(decoder, keep_statements, chunks))
 	{
-		std::cerr << "You should provide a file name." << std::endl;
-		return -1;
+		if (!decoder.failed())
+			return false;
+		binary_tokens = false;	// damaged, lex the source instead
+		chunks.clear();
 	}
-	std::string evl_file=argv[1];
-	evl_tokens tokens;
-	if (!extract_tokens_from_file(evl_file, tokens))  
+	if (!binary_tokens && !parse_source(source, threads, keep_statements, chunks))
 	{
-		return -1;
+		return false;
 	}
-	if(!store_tokens_to_file(evl_file+".tokens",tokens)) 
+	if(dump.count("tokens") && !binary_tokens && !store_tokens_to_file(evl_file+".tokens")) 
 	{
-		return -1;
+		return false;
+	}
+	if(dump.count("statements") && !store_statements_to_file(evl_file+".statements",chunks))
+	{
+		return false;
+	}
+
+ 	join_chunks(chunks, modules);
+
+	if (dump.count("syntax"))
+	{
+		std::ofstream output_file((evl_file+ ".syntax").c_str());      //creating ".syntax" file
+		for (evl_modules::const_iterator it = modules.begin(); it != modules.end(); ++it)
+		{
+			output_file << "module"  <<" "<< it->name<<" "<< '\n';
+			display_wires(output_file,it->wires);
+			display_components(output_file,it->components);
+		}
+	}
+
+	// the netlist is flattened into the top module, which is all that is
+	// kept of the modules
+	std::string top;
+	if (!nl.create(modules, top))
+	{
+		return false;
 	}
+	modules.assign(1, evl_module());
+	modules.back().name = top;
+	return true;
+}
 
- 	evl_statements statements;
-	if(!group_tokens_into_statements(statements,tokens))
+int main(int argc, char *argv[])
+{
+	if (argc < 2)   // Input File 
+	{
+		std::cerr << "You should provide a file name." << std::endl;
+		return -1;
+	}
+	std::string evl_file=argv[1];
+	evl_options options;
+	int cycles = 1000, lanes = 1, threads = 0, cache = 1;	// without threads, parse on every core but simulate on one
+	const char *artifacts[] = {"tokens", "statements", "syntax"};
+	std::set<std::string> dump;	// intermediate files, none unless asked for
+	if (!parse_options(argc, argv, options)
+		|| !get_int_option(options, "cycles", 0, 2147483647, cycles)
+		|| !get_int_option(options, "lanes", 1, 256, lanes)
+		|| !get_int_option(options, "threads", 1, 256, threads)
+		|| !get_int_option(options, "cache", 0, 1, cache)
+		|| !get_list_option(options, "dump", artifacts, sizeof(artifacts)/sizeof(artifacts[0]), dump))
 	{
 		return -1;
 	}
-									
-	if(!store_statements_to_file(evl_file+".statements",statements))
+	std::string kernels = options.count("simd")? options["simd"]: "auto";
+	std::string engine = options.count("engine")? options["engine"]: "levelized";
+	evl_source source;
+	if (!source.open(evl_file))
 	{
 		return -1;
 	}
 
- 	evl_components components;
-	evl_wires wires;
+	// a fresh .evlb cache stands in for parsing and building the netlist
+	uint64_t source_hash = evl_hash(source.begin(), source.end());
 	evl_modules modules;
-
-
-	std::ofstream output_file((evl_file+ ".syntax").c_str());      //creating ".syntax" file
-	for (evl_statements::iterator it=statements.begin();it!= statements.end(); ++it)
-		{
-        	if ((*it).type == evl_statement::MODULE)
-			{
-				if(!process_module_statement(modules,(*it)))
-				{
-					return -1;
-				}
-			}
-		else if ((*it).type == evl_statement::WIRE)
-			{
-				if(!process_wire_statement(wires,(*it)))
-				{
-					return -1;
-				}
-			}
-
-		else if ((*it).type == evl_statement::COMPONENT)
+	netlist nl;
+	if (!cache || !dump.empty() || !nl.load(evl_file+".evlb", source_hash, modules))
+	{
+		modules.clear();
+		nl = netlist();
+		if (!build_netlist(evl_file, source, source_hash, (threads == 0)? evl_default_threads(): threads, dump, modules, nl))
 		{
-
-            	if(!process_Component_Statement(components,(*it)))
-			{
-				return -1;
-
-			}
+			return -1;
 		}
-
-		else
+		if (cache)
 		{
-			break ;
-
+			nl.save(evl_file+".evlb", source_hash, modules);
 		}
 	}
 
-	display_modules(output_file,modules);
-	display_wires(output_file,wires);
-	display_components(output_file,components);
-
-    	evl_wires_table wires_table = make_wires_table(wires);
-    	netlist nl;
-
-    	if (!nl.create(wires, components, wires_table)){
-       		return -1;
-    	}
-
     	std::ofstream outputfilenet((evl_file + ".netlist").c_str());//creating ".netlist" file
 		display_modules(outputfilenet,modules);
 		nl.display_netlist(outputfilenet);
+		outputfilenet.close();
+
+	if (!nl.simulate(evl_file, cycles, lanes, kernels, std::max(threads, 1), engine)){
+		return -1;
+	}
 	return 0;
 }
 
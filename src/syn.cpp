@@ -8,21 +8,22 @@
 #include <string>
 #include <vector>
 
-struct evl_token
-{
-	enum token_type{NAME,NUMBER,SINGLE};
-	token_type type;
-	std::string str;
-	int line_no;
-}; //Structure Evl_token
+#include "evl_lexer.h"
 
-typedef std::list<evl_token> evl_tokens;
+// the tokens of a statement, consumed from the front
+struct evl_token_range
+{
+	const evl_token *first, *last;
+	bool empty() const {return first == last;}
+	const evl_token &front() const {return *first;}
+	void pop_front() {++first;}
+}; //Structure evl_token_range
 
 struct evl_statement
 {
 	enum statement_type {MODULE,WIRE,COMPONENT,ENDMODULE};
 	statement_type type;
-	evl_tokens tokens;
+	evl_token_range tokens;
 }; //Structure evl_statement
 
 typedef std::list<evl_statement> evl_statements;
@@ -59,103 +60,6 @@ struct evl_component
 
 typedef std::list<evl_component>evl_components;
 
-bool extract_tokens_from_line(std::string line,int line_no, evl_tokens &tokens)
-{
-	for (size_t i = 0; i < line.size();)
-	{
-		if (line[i] == '/')
-		{
-			++i;
-			if ((i == line.size()) || (line[i] != '/'))
-			{
-				std::cerr << "LINE " << line_no	<< ": a single / is not allowed" << std::endl;
-				return false;
-			}
-			break;// skip the rest of the line by exiting the loop
-		}
-		else if (isspace(line[i]))
-		{
-		++i; // skip this space character
-		}
-		else if ((line[i] == '(') || (line[i] == ')')
-			|| (line[i] == '[') || (line[i] == ']')
-			|| (line[i] == ':') || (line[i] == ';')
-			|| (line[i] == ',') || (line[i] == '=')
-			|| (line[i] == '{') || (line[i] == '}'))	// implemented "{","}","=" as a SINGLE
-		{
-			evl_token token;
-			token.line_no=line_no;
-			token.type=evl_token::SINGLE;
-			token.str=std::string(1, line[i]);
-			tokens.push_back(token);
-			++i;
-		}
-		else if (((line[i] >= 'a') && (line[i] <= 'z'))       // a to z
-                        || ((line[i] >= 'A') && (line[i] <= 'Z'))    // A to Z
-                        || (line[i] == '_'))
-		{
-			size_t name_begin = i;
-			for (++i; i < line.size(); ++i)
-			{
-				if (!(((line[i] >= 'a') && (line[i] <= 'z'))
-				   || ((line[i] >= 'A') && (line[i] <= 'Z'))
-				   || ((line[i] >= '0') && (line[i] <= '9'))
-				   || (line[i] == '_') || (line[i] == '$')))
-				{
-					break;	// [name_begin, i] is the range for the token
-				}
-			}
-			evl_token token;
-			token.line_no=line_no;
-			token.type=evl_token::NAME;
-			token.str=line.substr(name_begin, i-name_begin);
-			tokens.push_back(token);
-		}
-		else if ((line[i] >= '0') && (line[i] <= '9')) // 0 to 9
-		{
-			size_t number_begin=i;
-			for (++i; i<line.size();++i)
-			{
-				if(!((line[i] >= '0') && (line[i] <= '9')))
-				{
-					break; 	// [number_begin, i] is the range for the token
-				}
-			}
-			evl_token token;
-			token.line_no=line_no;
-			token.type=evl_token::NUMBER;
-			token.str=line.substr(number_begin,i-number_begin);
-			tokens.push_back(token);
-		}
-		else
-		{
-			std::cerr << "LINE " << line_no	<< ": invalid character" << std::endl;
-			return false;
-		}
-	}
-	return true;
-}
-
-bool extract_tokens_from_file(std::string file_name, evl_tokens &tokens)
-{
-	std::ifstream input_file(file_name.c_str());
-	if (!input_file)
-	{
-		std::cerr << "Cannot read file: " << file_name << "." << std::endl;
-		return false;
-	}
-	tokens.clear();
-	std::string line;
-	for (int line_no = 1; std::getline(input_file, line); ++line_no)
-	{
-		if (!extract_tokens_from_line(line, line_no, tokens))
-		{
-			return false;
-		}
-	}
-	return true;
-}
-
 bool store_tokens_to_file(std::string file_name, const evl_tokens &tokens)
 {
 		std::ofstream output_file(file_name.c_str());
@@ -175,28 +79,33 @@ bool token_is_semicolon(const evl_token &token)
 		return false;
 }
 
-bool move_tokens_to_statement(evl_tokens &statement_tokens,evl_tokens &tokens)
+bool move_tokens_to_statement(evl_token_range &statement_tokens, evl_token_range &tokens)
 {
-	assert(statement_tokens.empty());
 	assert(!tokens.empty());
-	evl_tokens::iterator next_sc = std::find_if(tokens.begin(), tokens.end(), token_is_semicolon);
-	if (next_sc == tokens.end())
+	const evl_token *next_sc = std::find_if(tokens.first, tokens.last, token_is_semicolon);
+	if (next_sc == tokens.last)
 	{
 		std::cerr << "Din't find ';' reached the end of line. Aborting!!!!" <<std::endl;
 		return false;
 	}
 	++next_sc;
-	statement_tokens.splice(statement_tokens.begin(),tokens, tokens.begin(), next_sc);
+	statement_tokens.first = tokens.first;
+	statement_tokens.last = next_sc;
+	tokens.first = next_sc;
 	return true;
 }
 
-bool group_tokens_into_statements(evl_statements &statements ,evl_tokens &tokens)
+// the statements refer to the tokens, which must outlive them
+bool group_tokens_into_statements(evl_statements &statements, const evl_tokens &tokens_list)
 {
 	assert(statements.empty());
+	evl_token_range tokens;
+	tokens.first = tokens_list.empty()? 0: &tokens_list[0];
+	tokens.last = tokens.first+tokens_list.size();
 	for (;!tokens.empty();)
 	{
 	// Generate one token per iteration
-		evl_token token=tokens.front();
+		const evl_token &token=tokens.front();
 		if(token.type !=evl_token::NAME)
 		{
 			std::cerr<<"Need a NAME token but found '"<<token.str << "'on line"<<token.line_no<<std::endl;
@@ -215,8 +124,9 @@ bool group_tokens_into_statements(evl_statements &statements ,evl_tokens &tokens
 
 			evl_statement endmodule;
 			endmodule.type = evl_statement::ENDMODULE;
-			endmodule.tokens.push_back(token);
-			tokens.erase(tokens.begin());
+			endmodule.tokens.first = &token;
+			endmodule.tokens.last = &token+1;
+			tokens.pop_front();
 			statements.push_back(endmodule);;
 		}
 		else if (token.str == "wire")
@@ -285,7 +195,7 @@ bool process_module_statement(evl_modules &modules,evl_statement &s)
 	evl_module module;
 	for (; !s.tokens.empty(); s.tokens.pop_front())
 	{
-		evl_token t = s.tokens.front();
+		const evl_token &t = s.tokens.front();
 		if(t.type == evl_token::NAME)
 		{
 			module.name=t.str;
@@ -317,7 +227,7 @@ bool process_wire_statement(evl_wires &wires, evl_statement &s)
 
 	for (; !s.tokens.empty() && (state != DONE); s.tokens.pop_front())
 	{
-		evl_token t = s.tokens.front();
+		const evl_token &t = s.tokens.front();
 		//  take one token at a time and state with 'INIT' state
 		if (state == INIT)
 		{
@@ -384,7 +294,7 @@ bool process_wire_statement(evl_wires &wires, evl_statement &s)
 		{
 			if (t.type == evl_token::NUMBER)
 			{
-				Bus_Width = atoi(t.str.c_str())+1;
+				Bus_Width = atoi(std::string(t.str).c_str())+1;
 				state = BUS_MSB;
 			}
 			else
@@ -478,7 +388,7 @@ bool process_component_statement(evl_components &components,evl_statement &s)
 
 	for (; !s.tokens.empty() && (state != DONE); s.tokens.pop_front())
 	{
-		evl_token t = s.tokens.front();
+		const evl_token &t = s.tokens.front();
 		if (state == INIT)
 		{
 			if (t.type==evl_token::NAME)
@@ -563,7 +473,7 @@ bool process_component_statement(evl_components &components,evl_statement &s)
 		{
 			if (t.type == evl_token::NUMBER)
 			{
-				pin.bus_msb = atoi(t.str.c_str());
+				pin.bus_msb = atoi(std::string(t.str).c_str());
 				state = BUS_MSB;
 			}
 			else
@@ -592,7 +502,7 @@ bool process_component_statement(evl_components &components,evl_statement &s)
 		{
 			if (t.type == evl_token::NUMBER)
 			{
-				pin.bus_lsb = atoi(t.str.c_str());
+				pin.bus_lsb = atoi(std::string(t.str).c_str());
 				state = BUS_LSB;
 			}
 			else
@@ -697,15 +607,26 @@ int main(int argc, char *argv[])
 	}
 
 	std::string evl_file=argv[1];
+	evl_source source;
+	evl_token_decoder decoder;
 	evl_tokens tokens;
-	if (!extract_tokens_from_file(evl_file, tokens))\
+	if (!source.open(evl_file))
 	{
 		return -1;
 	}
 
-	if(!store_tokens_to_file(evl_file+".tokens",tokens))
+	// the tokens of a fresh binary .tokens file from lex format=binary are
+	// read back instead of lexing the source, and the file is kept
+	if (!load_binary_tokens(evl_file+".tokens", evl_hash(source.begin(), source.end()), decoder, tokens))
 	{
-		return -1;
+		if (!extract_tokens_from_source(source, tokens))
+		{
+			return -1;
+		}
+		if(!store_tokens_to_file(evl_file+".tokens",tokens))
+		{
+			return -1;
+		}
 	}
 
 	evl_statements statements;